@@ -0,0 +1,78 @@
+////////////////////////////////////////////////////////////////////////////////
+//                          DO NOT EDIT THIS FILE!                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//
+// [Bump malloc]
+//
+// A reference allocator which never reuses memory. Objects are carved out of
+// large chunks by bumping a pointer and my_free() is a no-op, so this is the
+// lower bound of the time any allocator can achieve (and the upper bound of
+// the memory it wastes).
+//
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+void *mmap_from_system(size_t size);
+void munmap_to_system(void *ptr, size_t size);
+
+#define BUMP_CHUNK_SIZE (1024 * 1024)
+
+// Chunks are linked with each other so that they can be released at the end.
+typedef struct bump_chunk_t {
+  struct bump_chunk_t *next;
+} bump_chunk_t;
+
+// The global information of the bump malloc.
+//   *  |chunks| points to the most recently mapped chunk.
+//   *  [|cur|, |end|) is the unused part of that chunk.
+typedef struct bump_heap_t {
+  bump_chunk_t *chunks;
+  char *cur;
+  char *end;
+} bump_heap_t;
+
+bump_heap_t bump_heap;
+
+// This is called at the beginning of each challenge.
+void bump_initialize() {
+  bump_heap.chunks = NULL;
+  bump_heap.cur = NULL;
+  bump_heap.end = NULL;
+}
+
+// This is called every time an object is allocated. |size| is guaranteed
+// to be a multiple of 8 bytes and meets 8 <= |size| <= 4000.
+void *bump_malloc(size_t size) {
+  if (bump_heap.end - bump_heap.cur < (ptrdiff_t)size) {
+    bump_chunk_t *chunk = (bump_chunk_t *)mmap_from_system(BUMP_CHUNK_SIZE);
+    chunk->next = bump_heap.chunks;
+    bump_heap.chunks = chunk;
+    bump_heap.cur = (char *)(chunk + 1);
+    bump_heap.end = (char *)chunk + BUMP_CHUNK_SIZE;
+  }
+  void *ptr = bump_heap.cur;
+  bump_heap.cur += size;
+  return ptr;
+}
+
+// This is called every time an object is freed. The memory is never reused.
+void bump_free(void *ptr) {}
+
+// This is called at the end of each challenge. The stats of the challenge
+// are read after this, so the chunks are released with munmap() directly
+// instead of munmap_to_system() to keep them intact.
+void bump_finalize() {
+  bump_chunk_t *chunk = bump_heap.chunks;
+  while (chunk) {
+    bump_chunk_t *next = chunk->next;
+    int ret = munmap(chunk, BUMP_CHUNK_SIZE);
+    assert(ret != -1);
+    (void)ret;
+    chunk = next;
+  }
+  bump_heap.chunks = NULL;
+}
@@ -5,14 +5,23 @@
 
 // Please read instructions in malloc.c and README.md
 
+#define _GNU_SOURCE  // sched_setaffinity()
 #include <assert.h>
 #include <math.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// The size buckets of the workload models of trace/workload_generator.bin.
+#include "../trace/buckets.h"
 
 //
 // [Simple malloc]
@@ -31,6 +40,23 @@ void my_free(void *ptr);
 void my_finalize();
 void test();
 
+//
+// [Bump malloc]
+//
+void bump_initialize();
+void *bump_malloc(size_t size);
+void bump_free(void *ptr);
+void bump_finalize();
+
+//
+// [Arenas of my malloc]
+//
+typedef struct my_arena_t my_arena_t;
+my_arena_t *my_arena_create();
+void *my_arena_alloc(my_arena_t *arena, size_t size);
+void my_arena_reset(my_arena_t *arena);
+void my_arena_destroy(my_arena_t *arena);
+
 // This is code to run challenges. Please do NOT modify the code.
 
 // Vector
@@ -140,21 +166,40 @@ typedef struct stats_t {
   double end_time;
   size_t mmap_size;
   size_t munmap_size;
+  size_t madvise_size;
   size_t allocated_size;
   size_t freed_size;
+  // Page faults taken while the challenge touches memory. The faults taken
+  // to populate pages up front (--populate) are counted separately.
+  size_t page_faults;
+  size_t populate_faults;
 } stats_t;
 
 stats_t stats;
 FILE *trace_fp;
+// With --populate, the pages from mmap_from_system() and
+// recommit_from_system() are faulted in up front, in one system call.
+bool populate_pages;
+
+// Return the number of page faults this process has taken so far.
+size_t get_page_faults() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt + usage.ru_majflt;
+}
 
 // Run one challenge.
 // |min_size|: The min size of an allocated object
 // |max_size|: The max size of an allocated object
 // |*_func|: Function pointers to initialize / malloc / free.
+// |use_epoch_arenas|: Allocate the objects from per-epoch arenas instead of
+//                     |malloc_func|. The objects freed in the same epoch share
+//                     an arena, which is reset at that epoch instead of
+//                     calling |free_func| for each object.
 void run_challenge(const char *trace_file_name, size_t min_size,
                    size_t max_size, initialize_func_t initialize_func,
                    malloc_func_t malloc_func, free_func_t free_func,
-                   finalize_func_t finalize_func) {
+                   finalize_func_t finalize_func, bool use_epoch_arenas) {
   trace_fp = NULL;
 #ifdef ENABLE_MALLOC_TRACE
   if (trace_file_name) {
@@ -176,12 +221,20 @@ void run_challenge(const char *trace_file_name, size_t min_size,
   char tag = 0;
   // The last entry of the vector is used to store objects that are never freed.
   vector_t *objects[epochs_per_cycle + 1];
+  my_arena_t *arenas[epochs_per_cycle + 1];
   for (int i = 0; i < epochs_per_cycle + 1; i++) {
     objects[i] = vector_create();
   }
   initialize_func();
-  stats.mmap_size = stats.munmap_size = 0;
+  stats.mmap_size = stats.munmap_size = stats.madvise_size = 0;
   stats.allocated_size = stats.freed_size = 0;
+  stats.page_faults = get_page_faults();
+  stats.populate_faults = 0;
+  if (use_epoch_arenas) {
+    for (int i = 0; i < epochs_per_cycle + 1; i++) {
+      arenas[i] = my_arena_create();
+    }
+  }
   stats.begin_time = get_time();
   for (int cycle = 0; cycle < cycles; cycle++) {
     for (int epoch = 0; epoch < epochs_per_cycle; epoch++) {
@@ -200,7 +253,11 @@ void run_challenge(const char *trace_file_name, size_t min_size,
         int lifetime = get_object_lifetime(1, epochs_per_cycle);
         stats.allocated_size += size;
         allocated += size;
-        void *ptr = malloc_func(size);
+        // 4% of objects are set as never freed.
+        int free_epoch = urand() < 0.04 ? epochs_per_cycle
+                                        : (epoch + lifetime) % epochs_per_cycle;
+        void *ptr = use_epoch_arenas ? my_arena_alloc(arenas[free_epoch], size)
+                                     : malloc_func(size);
         if (trace_fp) {
           fprintf(trace_fp, "a %llu %ld\n", (unsigned long long)ptr, size);
         }
@@ -212,12 +269,7 @@ void run_challenge(const char *trace_file_name, size_t min_size,
           // mmaped memory.
           tag++;
         }
-        if (urand() < 0.04) {
-          // 4% of objects are set as never freed.
-          vector_push(objects[epochs_per_cycle], object);
-        } else {
-          vector_push(objects[(epoch + lifetime) % epochs_per_cycle], object);
-        }
+        vector_push(objects[free_epoch], object);
       }
 
       // Free objects that are expected to be freed in this epoch.
@@ -236,7 +288,12 @@ void run_challenge(const char *trace_file_name, size_t min_size,
           fprintf(trace_fp, "f %llu %ld\n", (unsigned long long)object.ptr,
                   object.size);
         }
-        free_func(object.ptr);
+        if (!use_epoch_arenas) {
+          free_func(object.ptr);
+        }
+      }
+      if (use_epoch_arenas) {
+        my_arena_reset(arenas[epoch]);
       }
 
 #if 0
@@ -249,15 +306,27 @@ void run_challenge(const char *trace_file_name, size_t min_size,
              stats.mmap_size / 1024.0 / 1024.0,
              stats.munmap_size / 1024.0 / 1024.0,
              (int)(100.0 * (stats.allocated_size - stats.freed_size)
-                   / (stats.mmap_size - stats.munmap_size)));
+                   / (stats.mmap_size - stats.munmap_size
+                      - stats.madvise_size)));
 #endif
       vector_clear(vector);
     }
   }
   stats.end_time = get_time();
+  stats.page_faults =
+      get_page_faults() - stats.page_faults - stats.populate_faults;
   for (int i = 0; i < epochs_per_cycle + 1; i++) {
     vector_destroy(objects[i]);
   }
+  if (use_epoch_arenas) {
+    // The stats are read after this, so keep them from counting the arenas
+    // as returned to the system.
+    stats_t challenge_stats = stats;
+    for (int i = 0; i < epochs_per_cycle + 1; i++) {
+      my_arena_destroy(arenas[i]);
+    }
+    stats = challenge_stats;
+  }
   finalize_func();
   if (trace_fp) {
     fclose(trace_fp);
@@ -268,33 +337,200 @@ void run_challenge(const char *trace_file_name, size_t min_size,
 #define FIRST_CHALLENGE_INDEX 1
 #define LAST_CHALLENGE_INDEX 5
 
+// The object size range of each challenge.
+typedef struct challenge_t {
+  size_t min_size;
+  size_t max_size;
+} challenge_t;
+
+const challenge_t challenges[LAST_CHALLENGE_INDEX + 1] = {
+    {0, 0},  // Unused.
+    {128, 128}, {16, 16}, {16, 128}, {256, 4000}, {8, 4000},
+};
+
+//
+// [glibc malloc]
+//
+// The system allocator, as a reference. It does not get memory through
+// mmap_from_system(), so the memory it holds is measured with mallinfo2()
+// instead: how much more the arenas (and the mmapped chunks) hold at the end
+// of the challenge than before it began. The free memory glibc keeps from the
+// previous runs is trimmed first, but what it can not give back would be
+// reused without being counted (even above 100% utilization), so glibc is
+// always run in a child process of its own.
+//
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAVE_GLIBC_MALLOC
+
+size_t glibc_held_size_at_initialize;
+
+void glibc_initialize() {
+  malloc_trim(0);
+  struct mallinfo2 info = mallinfo2();
+  glibc_held_size_at_initialize = info.arena + info.hblkhd;
+}
+
+void *glibc_malloc(size_t size) { return malloc(size); }
+
+void glibc_free(void *ptr) { free(ptr); }
+
+void glibc_finalize() {
+  struct mallinfo2 info = mallinfo2();
+  size_t held_size = info.arena + info.hblkhd;
+  stats.mmap_size = held_size > glibc_held_size_at_initialize
+                        ? held_size - glibc_held_size_at_initialize
+                        : 0;
+}
+#endif
+
+//
+// [Allocator registry]
+//
+// Every allocator which can be selected with --allocators. |name| is used on
+// the command line and in the trace file names.
+//
+typedef struct allocator_t {
+  const char *name;
+  const char *display_name;
+  initialize_func_t initialize_func;
+  malloc_func_t malloc_func;
+  free_func_t free_func;
+  finalize_func_t finalize_func;
+  // Run the challenges with per-epoch arenas (see run_challenge()).
+  bool use_epoch_arenas;
+  // Always run in a child process of its own (see [Isolated runs]), since
+  // what the harness process did before skews the stats.
+  bool needs_isolation;
+} allocator_t;
+
+const allocator_t allocators[] = {
+    {"simple", "simple_malloc", simple_initialize, simple_malloc, simple_free,
+     simple_finalize, false, false},
+    {"my", "my_malloc", my_initialize, my_malloc, my_free, my_finalize,
+     false, false},
+    {"bump", "bump_malloc", bump_initialize, bump_malloc, bump_free,
+     bump_finalize, false, false},
+    {"arena", "my_arena", my_initialize, NULL, NULL, my_finalize, true, false},
+#ifdef HAVE_GLIBC_MALLOC
+    {"glibc", "glibc_malloc", glibc_initialize, glibc_malloc, glibc_free,
+     glibc_finalize, false, true},
+#endif
+};
+
+#define NUM_ALLOCATORS ((int)(sizeof(allocators) / sizeof(allocators[0])))
+#define MY_ALLOCATOR_INDEX 1
+
+// Return the index of the allocator named |name| in |allocators|, or -1.
+int find_allocator(const char *name) {
+  for (int i = 0; i < NUM_ALLOCATORS; i++) {
+    if (strcmp(allocators[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Run one challenge with |allocator|.
+void run_challenge_with(const char *trace_file_name, int challenge_index,
+                        const allocator_t *allocator) {
+  run_challenge(trace_file_name, challenges[challenge_index].min_size,
+                challenges[challenge_index].max_size,
+                allocator->initialize_func, allocator->malloc_func,
+                allocator->free_func, allocator->finalize_func,
+                allocator->use_epoch_arenas);
+}
+
+// Allocators to run, in the order of the columns. Parsed from the
+// comma-separated list given to --allocators.
+typedef struct allocator_selection_t {
+  int indices[NUM_ALLOCATORS];
+  int count;
+} allocator_selection_t;
+
+bool parse_allocator_selection(const char *list,
+                               allocator_selection_t *selection) {
+  char name[32];
+  selection->count = 0;
+  while (*list) {
+    size_t length = strcspn(list, ",");
+    if (length == 0 || length >= sizeof(name) ||
+        selection->count == NUM_ALLOCATORS) {
+      return false;
+    }
+    memcpy(name, list, length);
+    name[length] = '\0';
+    int index = find_allocator(name);
+    if (index < 0) {
+      fprintf(stderr, "Unknown allocator: %s\n", name);
+      return false;
+    }
+    selection->indices[selection->count++] = index;
+    list += length;
+    if (*list == ',') list++;
+  }
+  return selection->count > 0;
+}
+
 int my_malloc_time_ms[LAST_CHALLENGE_INDEX + 1];
 int my_malloc_utilization_percentage[LAST_CHALLENGE_INDEX + 1];
 
-// Print stats
-void print_stats(int challenge_index, stats_t simple_stats, stats_t my_stats) {
+// Return the elapsed time of a challenge in milliseconds.
+double get_time_ms(stats_t *s) { return (s->end_time - s->begin_time) * 1000; }
+
+// Return the utilization of a challenge in percentage, i.e. the ratio of the
+// live object size to the memory held from the system at the end.
+double get_utilization_percentage(stats_t *s) {
+  return 100.0 * (s->allocated_size - s->freed_size) /
+         (s->mmap_size - s->munmap_size - s->madvise_size);
+}
+
+// Print stats of the selected allocators side by side under |title|.
+void print_stats_table(const char *title, allocator_selection_t *selection,
+                       stats_t *allocator_stats) {
+  printf("====================================================\n");
+  printf("%-16s|", title);
+  for (int i = 0; i < selection->count; i++) {
+    printf("%s %15s", i ? " =>" : "",
+           allocators[selection->indices[i]].display_name);
+  }
+  printf("\n%-16s+", "---------------");
+  for (int i = 0; i < selection->count; i++) {
+    printf("%s %15s", i ? " =>" : "", "---------------");
+  }
+  printf("\n%16s|", "Time [ms]");
+  for (int i = 0; i < selection->count; i++) {
+    printf("%s %15d", i ? " =>" : "", (int)get_time_ms(&allocator_stats[i]));
+  }
+  printf("\n%16s|", "Utilization [%] ");
+  for (int i = 0; i < selection->count; i++) {
+    printf("%s %15d", i ? " =>" : "",
+           (int)get_utilization_percentage(&allocator_stats[i]));
+  }
+  printf("\n%16s|", "Page faults ");
+  for (int i = 0; i < selection->count; i++) {
+    printf("%s %15zu", i ? " =>" : "", allocator_stats[i].page_faults);
+  }
+  printf("\n");
+}
+
+// Print stats of the selected allocators side by side.
+void print_stats(int challenge_index, allocator_selection_t *selection,
+                 stats_t *allocator_stats) {
   assert(FIRST_CHALLENGE_INDEX <= challenge_index &&
          challenge_index <= LAST_CHALLENGE_INDEX);
-  printf("====================================================\n");
-  printf("Challenge #%d    | %15s => %15s\n", challenge_index, "simple_malloc",
-         "my_malloc");
-  printf("%-16s+ %15s => %15s\n", "---------------", "---------------",
-         "---------------");
-  int simple_time_ms = (simple_stats.end_time - simple_stats.begin_time) * 1000;
-  int my_time_ms = (my_stats.end_time - my_stats.begin_time) * 1000;
-  int simple_utilization_percentage =
-      (int)(100.0 * (simple_stats.allocated_size - simple_stats.freed_size) /
-            (simple_stats.mmap_size - simple_stats.munmap_size));
-  int my_utilization_percentage =
-      (int)(100.0 * (my_stats.allocated_size - my_stats.freed_size) /
-            (my_stats.mmap_size - my_stats.munmap_size));
-
-  printf("%16s| %15d => %15d\n", "Time [ms]", simple_time_ms, my_time_ms);
-  printf("%16s| %15d => %15d\n", "Utilization [%] ",
-         simple_utilization_percentage, my_utilization_percentage);
-
-  my_malloc_time_ms[challenge_index] = my_time_ms;
-  my_malloc_utilization_percentage[challenge_index] = my_utilization_percentage;
+  char title[32];
+  snprintf(title, sizeof(title), "Challenge #%d", challenge_index);
+  print_stats_table(title, selection, allocator_stats);
+
+  for (int i = 0; i < selection->count; i++) {
+    if (selection->indices[i] == MY_ALLOCATOR_INDEX) {
+      my_malloc_time_ms[challenge_index] = get_time_ms(&allocator_stats[i]);
+      my_malloc_utilization_percentage[challenge_index] =
+          get_utilization_percentage(&allocator_stats[i]);
+    }
+  }
 }
 
 void print_score_data() {
@@ -306,9 +542,448 @@ void print_score_data() {
   printf("\n");
 }
 
+//
+// [Workload replay]
+//
+// Runs a workload model fitted to a real malloc trace by
+// trace/workload_generator.bin (see the model format there) instead of the
+// synthetic challenges. The object sizes follow the size distribution of the
+// trace, and each object is freed once its lifetime has passed, which is
+// drawn from the lifetimes of the objects of a similar size in the trace.
+// |scale| allocates that many times as many objects as the trace did, so that
+// a short trace can be run for much longer.
+//
+
+typedef struct workload_bucket_t {
+  double immortal_fraction;
+  // The quantiles of the lifetime in ops, or NULL if the trace has no object
+  // in this bucket.
+  double *quantiles;
+} workload_bucket_t;
+
+typedef struct workload_t {
+  size_t allocations;
+  size_t num_sizes;
+  size_t *sizes;
+  // The number of the objects with sizes[0], ..., sizes[i].
+  double *cumulative_counts;
+  int num_quantiles;
+  // Indexed by the size bucket [2^b, 2^(b+1)) of the size in the trace.
+  workload_bucket_t buckets[NUM_BUCKETS];
+} workload_t;
+
+void free_workload(workload_t *workload) {
+  free(workload->sizes);
+  free(workload->cumulative_counts);
+  for (int b = 0; b < NUM_BUCKETS; b++) {
+    free(workload->buckets[b].quantiles);
+  }
+}
+
+bool read_workload(const char *file_name, workload_t *workload) {
+  FILE *fp = fopen(file_name, "r");
+  if (!fp) {
+    fprintf(stderr, "Failed to open a workload model: %s\n", file_name);
+    return false;
+  }
+  memset(workload, 0, sizeof(*workload));
+  size_t ops, num_buckets;
+  bool ok = fscanf(fp, " workload %zu %zu sizes %zu", &workload->allocations,
+                   &ops, &workload->num_sizes) == 3;
+  if (ok) {
+    workload->sizes = (size_t *)malloc(workload->num_sizes * sizeof(size_t));
+    workload->cumulative_counts =
+        (double *)malloc(workload->num_sizes * sizeof(double));
+  }
+  double total = 0;
+  for (size_t i = 0; ok && i < workload->num_sizes; i++) {
+    size_t count;
+    ok = fscanf(fp, " %zu %zu", &workload->sizes[i], &count) == 2;
+    total += count;
+    workload->cumulative_counts[i] = total;
+  }
+  ok = ok && fscanf(fp, " lifetimes %zu %d", &num_buckets,
+                    &workload->num_quantiles) == 2 &&
+       workload->num_quantiles >= 2;
+  for (size_t i = 0; ok && i < num_buckets; i++) {
+    int b;
+    size_t count;
+    double immortal_fraction;
+    ok = fscanf(fp, " %d %zu %lf", &b, &count, &immortal_fraction) == 3 &&
+         0 <= b && b < NUM_BUCKETS;
+    if (!ok) break;
+    workload_bucket_t *bucket = &workload->buckets[b];
+    bucket->immortal_fraction = immortal_fraction;
+    bucket->quantiles =
+        (double *)malloc(workload->num_quantiles * sizeof(double));
+    for (int q = 0; ok && q < workload->num_quantiles; q++) {
+      ok = fscanf(fp, " %lf", &bucket->quantiles[q]) == 1;
+    }
+  }
+  fclose(fp);
+  if (!ok || workload->allocations == 0 || total == 0) {
+    fprintf(stderr, "Broken workload model: %s\n", file_name);
+    free_workload(workload);
+    return false;
+  }
+  return true;
+}
+
+// Return a size in the trace, drawn from the size distribution.
+size_t get_workload_size(workload_t *workload) {
+  double x = urand() * workload->cumulative_counts[workload->num_sizes - 1];
+  size_t low = 0;
+  size_t high = workload->num_sizes - 1;
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    if (workload->cumulative_counts[middle] <= x) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return workload->sizes[low];
+}
+
+// Return the lifetime in ops of an object of |size| in the trace, or 0 if it
+// is never freed.
+size_t get_workload_lifetime(workload_t *workload, size_t size) {
+  workload_bucket_t *bucket = &workload->buckets[bucket_of(size)];
+  double u = urand();
+  if (!bucket->quantiles || u < bucket->immortal_fraction) {
+    return 0;
+  }
+  // Interpolate between the quantiles.
+  int last = workload->num_quantiles - 1;
+  double x = (u - bucket->immortal_fraction) /
+             (1 - bucket->immortal_fraction) * last;
+  int q = x < last - 1 ? (int)x : last - 1;
+  double lifetime = bucket->quantiles[q] +
+                    (bucket->quantiles[q + 1] - bucket->quantiles[q]) * (x - q);
+  return lifetime < 1 ? 1 : (size_t)(lifetime + 0.5);
+}
+
+// A min-heap of the objects to free, ordered by the op to free them at.
+typedef struct scheduled_free_t {
+  size_t op;
+  object_t object;
+} scheduled_free_t;
+
+typedef struct free_queue_t {
+  size_t size;
+  size_t capacity;
+  scheduled_free_t *buffer;
+} free_queue_t;
+
+void free_queue_push(free_queue_t *queue, scheduled_free_t item) {
+  if (queue->size >= queue->capacity) {
+    queue->capacity = queue->capacity * 2 + 128;
+    queue->buffer = (scheduled_free_t *)realloc(
+        queue->buffer, queue->capacity * sizeof(scheduled_free_t));
+  }
+  size_t i = queue->size++;
+  while (i > 0 && queue->buffer[(i - 1) / 2].op > item.op) {
+    queue->buffer[i] = queue->buffer[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  queue->buffer[i] = item;
+}
+
+scheduled_free_t free_queue_pop(free_queue_t *queue) {
+  assert(queue->size > 0);
+  scheduled_free_t top = queue->buffer[0];
+  scheduled_free_t last = queue->buffer[--queue->size];
+  size_t i = 0;
+  for (;;) {
+    size_t child = i * 2 + 1;
+    if (child >= queue->size) break;
+    if (child + 1 < queue->size &&
+        queue->buffer[child + 1].op < queue->buffer[child].op) {
+      child++;
+    }
+    if (last.op <= queue->buffer[child].op) break;
+    queue->buffer[i] = queue->buffer[child];
+    i = child;
+  }
+  queue->buffer[i] = last;
+  return top;
+}
+
+// Run |workload| |scale| times over with |allocator|. The sizes are rounded up
+// to a multiple of 8 bytes and capped at 4000 bytes, the largest size of the
+// challenges, since that is what the allocators are written for.
+void run_workload(const char *trace_file_name, workload_t *workload,
+                  int scale, const allocator_t *allocator) {
+  const size_t max_size = challenges[LAST_CHALLENGE_INDEX].max_size;
+  trace_fp = NULL;
+#ifdef ENABLE_MALLOC_TRACE
+  if (trace_file_name) {
+    trace_fp = fopen(trace_file_name, "wb");
+    if (!trace_fp) {
+      fprintf(stderr, "Failed to open a trace file: %s\n", trace_file_name);
+      exit(EXIT_FAILURE);
+    }
+  }
+#endif
+  free_queue_t queue = {0, 0, NULL};
+  char tag = 0;
+  allocator->initialize_func();
+  stats.mmap_size = stats.munmap_size = stats.madvise_size = 0;
+  stats.allocated_size = stats.freed_size = 0;
+  stats.page_faults = get_page_faults();
+  stats.populate_faults = 0;
+  stats.begin_time = get_time();
+  size_t allocations = workload->allocations * scale;
+  // Every allocation and free is an op, the unit of the lifetimes.
+  size_t op = 0;
+  for (size_t i = 0; i < allocations; op++) {
+    if (queue.size > 0 && queue.buffer[0].op <= op) {
+      object_t object = free_queue_pop(&queue).object;
+      stats.freed_size += object.size;
+      // Check that the tag is not broken.
+      if (((char *)object.ptr)[0] != object.tag ||
+          ((char *)object.ptr)[object.size - 1] != object.tag) {
+        printf("An allocated object is broken!");
+        assert(0);
+      }
+      if (trace_fp) {
+        fprintf(trace_fp, "f %llu %ld\n", (unsigned long long)object.ptr,
+                object.size);
+      }
+      allocator->free_func(object.ptr);
+      continue;
+    }
+    size_t trace_size = get_workload_size(workload);
+    size_t lifetime = get_workload_lifetime(workload, trace_size);
+    size_t size = (trace_size + 7) / 8 * 8;
+    size = size < 8 ? 8 : size > max_size ? max_size : size;
+    stats.allocated_size += size;
+    void *ptr = allocator->malloc_func(size);
+    if (trace_fp) {
+      fprintf(trace_fp, "a %llu %ld\n", (unsigned long long)ptr, size);
+    }
+    memset(ptr, tag, size);
+    object_t object = {ptr, size, tag};
+    tag++;
+    if (tag == 0) {
+      tag++;
+    }
+    if (lifetime) {
+      scheduled_free_t item = {op + lifetime, object};
+      free_queue_push(&queue, item);
+    }
+    i++;
+  }
+  // The objects whose lifetime has not passed yet stay allocated, like the
+  // ones which are never freed.
+  stats.end_time = get_time();
+  stats.page_faults =
+      get_page_faults() - stats.page_faults - stats.populate_faults;
+  free(queue.buffer);
+  allocator->finalize_func();
+  if (trace_fp) {
+    fclose(trace_fp);
+    trace_fp = NULL;
+  }
+}
+
+//
+// [Isolated runs]
+//
+// With --isolate or --jobs, every run (of a challenge or of a workload model)
+// is forked into a child process so that the runs do not share the heap of
+// the harness, the page cache of the allocator or anything left over by the
+// previous run. The child is pinned to a CPU and sends its stats back over a
+// pipe. An allocator which can only be measured in a process of its own
+// (allocator_t::needs_isolation) is run this way even without the options,
+// one run at a time.
+//
+
+// A run of challenge |challenge_index|, or of |workload| |scale| times over if
+// |workload| is not NULL, with |allocator| from |seed|. Every run starts from
+// its seed, so that the allocators run exactly the same workload wherever
+// they run.
+typedef struct run_t {
+  const char *trace_file_name;
+  int challenge_index;
+  workload_t *workload;
+  int scale;
+  const allocator_t *allocator;
+  unsigned seed;
+} run_t;
+
+// Run |run| in this process. Its stats are left in |stats|.
+void run_in_process(const run_t *run) {
+  srand(run->seed);
+  if (run->workload) {
+    run_workload(run->trace_file_name, run->workload, run->scale,
+                 run->allocator);
+  } else {
+    run_challenge_with(run->trace_file_name, run->challenge_index,
+                       run->allocator);
+  }
+}
+
+typedef struct isolated_run_t {
+  pid_t pid;
+  int fd;  // The read end of the pipe from the child.
+  int cpu;
+  stats_t *result;  // Where the stats of the run are stored.
+} isolated_run_t;
+
+// Runs in child processes, up to |jobs| of them at once. |runs[r]| is pinned
+// to the same CPU whichever run it holds, and [0, |running|) of them are
+// running.
+typedef struct run_queue_t {
+  int jobs;
+  int running;
+  isolated_run_t *runs;
+} run_queue_t;
+
+// Return the number of CPUs this process may run on, or 0 if unknown.
+int get_cpu_count() {
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+    return 0;
+  }
+  return CPU_COUNT(&set);
+}
+
+// Return the |n|-th CPU this process may run on, or -1 if there is no such
+// CPU.
+int get_cpu(int n) {
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == -1 || n >= CPU_COUNT(&set)) {
+    return -1;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set) && n-- == 0) {
+      return cpu;
+    }
+  }
+  return -1;
+}
+
+// Initialize |queue| to run up to |jobs| children at once. 0 runs everything
+// in this process except the allocators which need isolation.
+void init_run_queue(run_queue_t *queue, int jobs) {
+  queue->jobs = jobs;
+  queue->running = 0;
+  queue->runs = NULL;
+  if (jobs > 0) {
+    queue->runs = (isolated_run_t *)malloc(jobs * sizeof(isolated_run_t));
+    for (int r = 0; r < jobs; r++) {
+      queue->runs[r].cpu = get_cpu(r);
+    }
+  }
+}
+
+// Start a child process which does |run| on |isolated_run->cpu|.
+void start_isolated_run(isolated_run_t *isolated_run, const run_t *run) {
+  int fds[2];
+  if (pipe(fds) == -1) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+  fflush(stdout);
+  isolated_run->pid = fork();
+  if (isolated_run->pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (isolated_run->pid == 0) {
+    close(fds[0]);
+    if (isolated_run->cpu >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(isolated_run->cpu, &set);
+      sched_setaffinity(0, sizeof(set), &set);
+    }
+    run_in_process(run);
+    ssize_t written = write(fds[1], &stats, sizeof(stats));
+    _exit(written == sizeof(stats) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  close(fds[1]);
+  isolated_run->fd = fds[0];
+}
+
+// Wait for any of the running children of |queue| to exit and store its
+// stats. Its slot becomes the first one which is not running.
+void finish_isolated_run(run_queue_t *queue) {
+  int status;
+  pid_t pid = wait(&status);
+  for (int i = 0; i < queue->running; i++) {
+    isolated_run_t *runs = queue->runs;
+    if (runs[i].pid != pid) {
+      continue;
+    }
+    stats_t child_stats;
+    ssize_t size = read(runs[i].fd, &child_stats, sizeof(child_stats));
+    close(runs[i].fd);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS ||
+        size != sizeof(child_stats)) {
+      fprintf(stderr, "An isolated run failed on CPU %d\n", runs[i].cpu);
+      exit(EXIT_FAILURE);
+    }
+    *runs[i].result = child_stats;
+    // Swap the slots rather than copy the last one over, so that the CPU of
+    // the finished run goes with its slot.
+    isolated_run_t finished = runs[i];
+    runs[i] = runs[--queue->running];
+    runs[queue->running] = finished;
+    return;
+  }
+  fprintf(stderr, "Unknown child process: %d\n", pid);
+  exit(EXIT_FAILURE);
+}
+
+// Wait for every child of |queue| and free it.
+void finish_run_queue(run_queue_t *queue) {
+  while (queue->running > 0) {
+    finish_isolated_run(queue);
+  }
+  free(queue->runs);
+}
+
+// Do |run| and store its stats in |*result| once it finishes: in a child
+// process when a slot of |queue| is free, or in this process if |queue| runs
+// nothing in children. The result is ready after finish_run_queue().
+void submit_run(run_queue_t *queue, const run_t *run, stats_t *result) {
+  if (queue->jobs == 0 && !run->allocator->needs_isolation) {
+    run_in_process(run);
+    *result = stats;
+  } else if (queue->jobs == 0) {
+    // Wait for the child right away so that it does not overlap the runs in
+    // this process.
+    run_queue_t own_queue;
+    init_run_queue(&own_queue, 1);
+    submit_run(&own_queue, run, result);
+    finish_run_queue(&own_queue);
+  } else {
+    if (queue->running == queue->jobs) {
+      finish_isolated_run(queue);
+    }
+    isolated_run_t *isolated_run = &queue->runs[queue->running++];
+    isolated_run->result = result;
+    start_isolated_run(isolated_run, run);
+  }
+}
+
+// Warm up this process with the first of the selected allocators, unless it
+// is never run in this process.
+void warm_up(allocator_selection_t *selection) {
+  const allocator_t *allocator = &allocators[selection->indices[0]];
+  if (!allocator->needs_isolation) {
+    run_challenge_with(NULL, 1, allocator);
+  }
+}
+
 // Run challenges
-void run_challenges() {
-  stats_t simple_stats, my_stats;
+void run_challenges(allocator_selection_t *selection, int jobs,
+                    unsigned seed) {
+  stats_t allocator_stats[LAST_CHALLENGE_INDEX + 1][NUM_ALLOCATORS];
+  char trace_file_name[64];
+  bool has_my_malloc = false;
 
 #ifdef ENABLE_MALLOC_TRACE
   printf(
@@ -317,53 +992,24 @@ void run_challenges() {
 #endif
 
   // Warm up run.
-  run_challenge(NULL, 128, 128, simple_initialize, simple_malloc, simple_free,
-                simple_finalize);
-
-  // Challenge 1:
-  run_challenge("trace1_simple.txt", 128, 128, simple_initialize, simple_malloc,
-                simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace1_my.txt", 128, 128, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(1, simple_stats, my_stats);
-
-  // Challenge 2:
-  run_challenge("trace2_simple.txt", 16, 16, simple_initialize, simple_malloc,
-                simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace2_my.txt", 16, 16, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(2, simple_stats, my_stats);
-
-  // Challenge 3:
-  run_challenge("trace3_simple.txt", 16, 128, simple_initialize, simple_malloc,
-                simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace3_my.txt", 16, 128, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(3, simple_stats, my_stats);
-
-  // Challenge 4:
-  run_challenge("trace4_simple.txt", 256, 4000, simple_initialize,
-                simple_malloc, simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace4_my.txt", 256, 4000, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(4, simple_stats, my_stats);
-
-  // Challenge 5:
-  run_challenge("trace5_simple.txt", 8, 4000, simple_initialize, simple_malloc,
-                simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace5_my.txt", 8, 4000, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(5, simple_stats, my_stats);
+  warm_up(selection);
+
+  run_queue_t queue;
+  init_run_queue(&queue, jobs);
+  for (int i = FIRST_CHALLENGE_INDEX; i <= LAST_CHALLENGE_INDEX; i++) {
+    for (int j = 0; j < selection->count; j++) {
+      const allocator_t *allocator = &allocators[selection->indices[j]];
+      snprintf(trace_file_name, sizeof(trace_file_name), "trace%d_%s.txt", i,
+               allocator->name);
+      run_t run = {trace_file_name, i, NULL, 0, allocator, seed};
+      submit_run(&queue, &run, &allocator_stats[i][j]);
+      has_my_malloc |= selection->indices[j] == MY_ALLOCATOR_INDEX;
+    }
+  }
+  finish_run_queue(&queue);
+  for (int i = FIRST_CHALLENGE_INDEX; i <= LAST_CHALLENGE_INDEX; i++) {
+    print_stats(i, selection, allocator_stats[i]);
+  }
 
 #ifdef ENABLE_MALLOC_TRACE
   printf(
@@ -372,24 +1018,434 @@ void run_challenges() {
 #endif
 
 #ifndef ENABLE_MALLOC_TRACE
-  print_score_data();
+  if (has_my_malloc) {
+    print_score_data();
+  }
 #endif
 }
 
-// Allocate a memory region from the system. |size| needs to be a multiple of
-// 4096 bytes.
-void *mmap_from_system(size_t size) {
+// Run the workload model in |file_name| with each of the selected allocators.
+int run_workloads(const char *file_name, int scale,
+                  allocator_selection_t *selection, int jobs, unsigned seed) {
+  workload_t workload;
+  if (!read_workload(file_name, &workload)) {
+    return EXIT_FAILURE;
+  }
+  for (int j = 0; j < selection->count; j++) {
+    const allocator_t *allocator = &allocators[selection->indices[j]];
+    if (allocator->use_epoch_arenas) {
+      fprintf(stderr, "%s has no epochs to run a workload model with\n",
+              allocator->name);
+      free_workload(&workload);
+      return EXIT_FAILURE;
+    }
+  }
+  stats_t allocator_stats[NUM_ALLOCATORS];
+  char trace_file_name[64];
+  run_queue_t queue;
+  init_run_queue(&queue, jobs);
+  for (int j = 0; j < selection->count; j++) {
+    const allocator_t *allocator = &allocators[selection->indices[j]];
+    snprintf(trace_file_name, sizeof(trace_file_name), "trace_workload_%s.txt",
+             allocator->name);
+    run_t run = {trace_file_name, 0, &workload, scale, allocator, seed};
+    submit_run(&queue, &run, &allocator_stats[j]);
+  }
+  finish_run_queue(&queue);
+  char title[32];
+  snprintf(title, sizeof(title), "Workload x%d", scale);
+  print_stats_table(title, selection, allocator_stats);
+  free_workload(&workload);
+  return EXIT_SUCCESS;
+}
+
+//
+// [Benchmark runner]
+//
+// Runs every challenge of the selected allocators for each of |seeds| random
+// seeds, |iterations| times per seed, and reports the mean, the standard
+// deviation and the 95% confidence interval of the time and the utilization.
+// The iterations of a seed are averaged first, so that n is the number of
+// seeds; repeating a seed only makes its time less noisy.
+// The summary written in the CSV format can be compared against another build
+// with --compare, which runs Welch's t-test on each metric.
+//
+
+typedef enum output_format_t {
+  OUTPUT_FORMAT_TEXT,
+  OUTPUT_FORMAT_CSV,
+  OUTPUT_FORMAT_JSON,
+} output_format_t;
+
+typedef struct benchmark_options_t {
+  int seeds;
+  int iterations;
+  unsigned first_seed;
+  output_format_t format;
+  allocator_selection_t selection;
+  // 0 runs every challenge in this process (see submit_run()). Otherwise each
+  // run is isolated in a child process pinned to a CPU, and up to |jobs| of
+  // them run at once.
+  int jobs;
+} benchmark_options_t;
+
+#define NUM_METRICS 3
+const char *metric_names[NUM_METRICS] = {"time_ms", "utilization",
+                                         "page_faults"};
+// Whether a larger value of each metric is a regression.
+const bool metric_higher_is_worse[NUM_METRICS] = {true, false, true};
+
+double get_metric(stats_t *s, int metric) {
+  switch (metric) {
+    case 0:
+      return get_time_ms(s);
+    case 1:
+      return get_utilization_percentage(s);
+    default:
+      return s->page_faults;
+  }
+}
+
+typedef struct summary_t {
+  int n;
+  double mean;
+  double stddev;
+} summary_t;
+
+// Summaries indexed by the allocator, the challenge and the metric.
+typedef summary_t summary_table_t[NUM_ALLOCATORS][LAST_CHALLENGE_INDEX + 1]
+                                 [NUM_METRICS];
+
+// Return the two-sided 95% critical value of Student's t-distribution with
+// |df| degrees of freedom. Values between the table entries are rounded
+// towards fewer degrees of freedom, which keeps the intervals conservative.
+double get_t_critical_value(int df) {
+  static const double table[] = {
+      0,     12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365,
+      2.306, 2.262,  2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+      2.120, 2.110,  2.101, 2.093, 2.086, 2.080, 2.074, 2.069,
+      2.064, 2.060,  2.056, 2.052, 2.048, 2.045, 2.042,
+  };
+  assert(df >= 1);
+  if (df <= 30) return table[df];
+  if (df <= 40) return table[30];
+  if (df <= 60) return 2.021;
+  if (df <= 120) return 2.000;
+  return 1.980;
+}
+
+summary_t summarize(double *samples, int n) {
+  summary_t summary = {n, 0, 0};
+  for (int i = 0; i < n; i++) {
+    summary.mean += samples[i];
+  }
+  summary.mean /= n;
+  if (n >= 2) {
+    double sum_of_squares = 0;
+    for (int i = 0; i < n; i++) {
+      sum_of_squares += (samples[i] - summary.mean) * (samples[i] - summary.mean);
+    }
+    summary.stddev = sqrt(sum_of_squares / (n - 1));
+  }
+  return summary;
+}
+
+// Return the half width of the 95% confidence interval of the mean.
+double get_ci95(summary_t summary) {
+  if (summary.n < 2) return 0;
+  return get_t_critical_value(summary.n - 1) * summary.stddev /
+         sqrt(summary.n);
+}
+
+void print_summaries(benchmark_options_t *options, summary_table_t summaries) {
+  if (options->format == OUTPUT_FORMAT_CSV) {
+    printf("challenge,allocator,metric,n,mean,stddev,ci95_low,ci95_high\n");
+  } else if (options->format == OUTPUT_FORMAT_JSON) {
+    printf("{\"seeds\": %d, \"iterations\": %d, \"first_seed\": %u, ",
+           options->seeds, options->iterations, options->first_seed);
+    printf("\"results\": [");
+  } else {
+    printf("%-10s %-14s %-12s %5s %12s %12s %27s\n", "challenge", "allocator",
+           "metric", "n", "mean", "stddev", "95% CI");
+  }
+  bool first = true;
+  for (int i = FIRST_CHALLENGE_INDEX; i <= LAST_CHALLENGE_INDEX; i++) {
+    for (int j = 0; j < options->selection.count; j++) {
+      int a = options->selection.indices[j];
+      const char *name = allocators[a].name;
+      for (int m = 0; m < NUM_METRICS; m++) {
+        summary_t s = summaries[a][i][m];
+        double ci95 = get_ci95(s);
+        if (options->format == OUTPUT_FORMAT_CSV) {
+          printf("%d,%s,%s,%d,%f,%f,%f,%f\n", i, name, metric_names[m], s.n,
+                 s.mean, s.stddev, s.mean - ci95, s.mean + ci95);
+        } else if (options->format == OUTPUT_FORMAT_JSON) {
+          printf(
+              "%s\n  {\"challenge\": %d, \"allocator\": \"%s\", "
+              "\"metric\": \"%s\", \"n\": %d, \"mean\": %f, \"stddev\": %f, "
+              "\"ci95\": [%f, %f]}",
+              first ? "" : ",", i, name, metric_names[m], s.n, s.mean,
+              s.stddev, s.mean - ci95, s.mean + ci95);
+        } else {
+          printf("%-10d %-14s %-12s %5d %12.3f %12.3f [%12.3f, %12.3f]\n", i,
+                 name, metric_names[m], s.n, s.mean, s.stddev, s.mean - ci95,
+                 s.mean + ci95);
+        }
+        first = false;
+      }
+    }
+  }
+  if (options->format == OUTPUT_FORMAT_JSON) {
+    printf("\n]}\n");
+  }
+}
+
+void run_benchmark(benchmark_options_t *options) {
+  allocator_selection_t *selection = &options->selection;
+  int n = options->seeds * options->iterations;
+  // The stats of the k-th run of challenge i with the j-th allocator are in
+  // results[(k * (LAST_CHALLENGE_INDEX + 1) + i) * selection->count + j].
+  stats_t *results = (stats_t *)malloc(
+      n * (LAST_CHALLENGE_INDEX + 1) * selection->count * sizeof(stats_t));
+  static summary_table_t summaries;
+
+  // Warm up run.
+  srand(options->first_seed);
+  warm_up(selection);
+
+  run_queue_t queue;
+  init_run_queue(&queue, options->jobs);
+  int k = 0;
+  for (int seed = 0; seed < options->seeds; seed++) {
+    for (int iteration = 0; iteration < options->iterations; iteration++) {
+      for (int i = FIRST_CHALLENGE_INDEX; i <= LAST_CHALLENGE_INDEX; i++) {
+        for (int j = 0; j < selection->count; j++) {
+          // Every challenge starts from the same seed so that the iterations
+          // of a seed, and all the allocators, run exactly the same workload.
+          run_t run = {NULL, i, NULL, 0, &allocators[selection->indices[j]],
+                       options->first_seed + seed};
+          submit_run(
+              &queue, &run,
+              &results[(k * (LAST_CHALLENGE_INDEX + 1) + i) * selection->count +
+                       j]);
+        }
+      }
+      k++;
+    }
+  }
+  finish_run_queue(&queue);
+
+  // The iterations of a seed run the same workload, so they are not
+  // independent samples. Each seed contributes the mean of its iterations.
+  double *samples = (double *)malloc(n * sizeof(double));
+  double *seed_samples = (double *)malloc(options->seeds * sizeof(double));
+  for (int j = 0; j < selection->count; j++) {
+    for (int i = FIRST_CHALLENGE_INDEX; i <= LAST_CHALLENGE_INDEX; i++) {
+      for (int m = 0; m < NUM_METRICS; m++) {
+        for (k = 0; k < n; k++) {
+          samples[k] = get_metric(
+              &results[(k * (LAST_CHALLENGE_INDEX + 1) + i) * selection->count +
+                       j],
+              m);
+        }
+        for (int seed = 0; seed < options->seeds; seed++) {
+          seed_samples[seed] =
+              summarize(&samples[seed * options->iterations],
+                        options->iterations)
+                  .mean;
+        }
+        summaries[selection->indices[j]][i][m] =
+            summarize(seed_samples, options->seeds);
+      }
+    }
+  }
+  free(seed_samples);
+  free(samples);
+  free(results);
+  print_summaries(options, summaries);
+}
+
+// Read a summary written by run_benchmark() in the CSV format. Returns false
+// if the file can not be read.
+bool read_summaries(const char *file_name, summary_table_t summaries) {
+  FILE *fp = fopen(file_name, "r");
+  if (!fp) {
+    fprintf(stderr, "Failed to open a benchmark result: %s\n", file_name);
+    return false;
+  }
+  memset(summaries, 0, sizeof(summary_table_t));
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    int challenge_index;
+    char allocator_name[32];
+    char metric[32];
+    summary_t s;
+    if (sscanf(line, "%d,%31[^,],%31[^,],%d,%lf,%lf", &challenge_index,
+               allocator_name, metric, &s.n, &s.mean, &s.stddev) != 6) {
+      continue;  // The header line.
+    }
+    int a = find_allocator(allocator_name);
+    if (a < 0 || challenge_index < FIRST_CHALLENGE_INDEX ||
+        LAST_CHALLENGE_INDEX < challenge_index) {
+      continue;
+    }
+    for (int m = 0; m < NUM_METRICS; m++) {
+      if (strcmp(metric, metric_names[m]) == 0) {
+        summaries[a][challenge_index][m] = s;
+      }
+    }
+  }
+  fclose(fp);
+  return true;
+}
+
+// Compare two benchmark results with Welch's t-test at the 5% significance
+// level. Every (challenge, allocator, metric) found in both results is
+// compared. Returns EXIT_FAILURE if the candidate is significantly slower or
+// has a significantly lower utilization than the baseline, so that this can
+// be used to gate regressions.
+int compare_benchmarks(const char *baseline_file_name,
+                       const char *candidate_file_name) {
+  static summary_table_t baseline;
+  static summary_table_t candidate;
+  if (!read_summaries(baseline_file_name, baseline) ||
+      !read_summaries(candidate_file_name, candidate)) {
+    return EXIT_FAILURE;
+  }
+  bool regressed = false;
+  printf("%-10s %-14s %-12s %12s %12s %9s %8s  %s\n", "challenge",
+         "allocator", "metric", "baseline", "candidate", "change", "t",
+         "verdict");
+  for (int i = FIRST_CHALLENGE_INDEX; i <= LAST_CHALLENGE_INDEX; i++) {
+    for (int j = 0; j < NUM_ALLOCATORS; j++) {
+      for (int m = 0; m < NUM_METRICS; m++) {
+        summary_t a = baseline[j][i][m];
+        summary_t b = candidate[j][i][m];
+        if (a.n == 0 || b.n == 0) {
+          continue;  // Not measured on both sides.
+        }
+        if (a.n < 2 || b.n < 2) {
+          printf("%-10d %-14s %-12s %12s %12s %9s %8s  %s\n", i,
+                 allocators[j].name, metric_names[m], "-", "-", "-", "-",
+                 "not enough samples");
+          continue;
+        }
+        double va = a.stddev * a.stddev / a.n;
+        double vb = b.stddev * b.stddev / b.n;
+        double diff = b.mean - a.mean;
+        double change = a.mean != 0 ? 100.0 * diff / a.mean : 0;
+        const char *verdict = "no significant change";
+        double t = 0;
+        if (va + vb == 0) {
+          // Both sides are deterministic (e.g. the utilization of a fixed
+          // seed), so any difference is significant.
+          if (diff != 0) verdict = "changed";
+        } else {
+          t = diff / sqrt(va + vb);
+          // Welch-Satterthwaite equation.
+          double df = (va + vb) * (va + vb) /
+                      (va * va / (a.n - 1) + vb * vb / (b.n - 1));
+          if (fabs(t) > get_t_critical_value(df >= 1 ? (int)df : 1)) {
+            verdict = "changed";
+          }
+        }
+        if (strcmp(verdict, "changed") == 0) {
+          // e.g. A longer time or a lower utilization is a regression.
+          bool worse = metric_higher_is_worse[m] ? diff > 0 : diff < 0;
+          verdict = worse ? "REGRESSION" : "improvement";
+          regressed |= worse;
+        }
+        printf("%-10d %-14s %-12s %12.3f %12.3f %+8.2f%% %8.2f  %s\n", i,
+               allocators[j].name, metric_names[m], a.mean, b.mean, change, t,
+               verdict);
+      }
+    }
+  }
+  return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  (no options)            Run the challenges for the score sheet.\n"
+          "  --allocators A,B,...    Allocators to run (default: simple,my\n"
+          "                          for the score sheet, my for --seeds\n"
+          "                          and --workload).\n"
+          "                          Available:",
+          argv0);
+  for (int i = 0; i < NUM_ALLOCATORS; i++) {
+    fprintf(stderr, " %s", allocators[i].name);
+  }
+  fprintf(stderr,
+          "\n"
+          "  --seeds N               Run with N seeds and report statistics\n"
+          "                          instead.\n"
+          "  --iterations N          Repeat each seed N times (default: 1).\n"
+          "  --first-seed S          Use seeds S, S+1, ... (default: 12).\n"
+          "                          The score sheet and --workload use S.\n"
+          "  --format text|csv|json  Output format (default: text).\n"
+          "  --workload MODEL        Run a workload model fitted to a trace by\n"
+          "                          trace/workload_generator.bin instead.\n"
+          "  --scale N               Allocate N times as many objects as the\n"
+          "                          trace of --workload did (default: 1).\n"
+          "  --populate              Fault in the pages from mmap_from_system()\n"
+          "                          and recommit_from_system() up front.\n"
+          "  --isolate               Run each challenge (or --workload) of\n"
+          "                          each allocator in a child process\n"
+          "                          pinned to a CPU.\n"
+          "  --jobs N                Like --isolate, but run up to N children\n"
+          "                          at once on different CPUs (at most\n"
+          "                          the number of CPUs).\n"
+          "  --compare BASE CAND     Compare two CSV results and fail on a\n"
+          "                          significant regression.\n");
+}
+
+// Allocate a memory region from the system like mmap_from_system(), but count
+// the pages after the first |committed_size| bytes as decommitted, as if they
+// had been passed to madvise_to_system(). Fresh pages are not backed by
+// physical memory until they are touched, so no system call is needed to
+// decommit them, and --populate does not fault them in. The caller must
+// report their reuse with recommit_from_system(). |size| and |committed_size|
+// need to be a multiple of 4096 bytes.
+void *mmap_decommitted_from_system(size_t size, size_t committed_size) {
   assert(size % 4096 == 0);
+  assert(committed_size % 4096 == 0 && committed_size <= size);
   stats.mmap_size += size;
-  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
-                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  stats.madvise_size += size - committed_size;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  size_t page_faults = 0;
+  if (populate_pages) {
+    if (committed_size == size) {
+      flags |= MAP_POPULATE;
+    }
+    page_faults = get_page_faults();
+  }
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+#ifdef MADV_POPULATE_WRITE
+  if (populate_pages && committed_size > 0 && committed_size < size) {
+    madvise(ptr, committed_size, MADV_POPULATE_WRITE);
+  }
+#endif
+  if (populate_pages) {
+    stats.populate_faults += get_page_faults() - page_faults;
+  }
   assert(ptr);
   if (trace_fp) {
     fprintf(trace_fp, "m %llu %ld\n", (unsigned long long)ptr, size);
+    if (committed_size < size) {
+      fprintf(trace_fp, "d %llu %ld\n",
+              (unsigned long long)ptr + committed_size, size - committed_size);
+    }
   }
   return ptr;
 }
 
+// Allocate a memory region from the system. |size| needs to be a multiple of
+// 4096 bytes.
+void *mmap_from_system(size_t size) {
+  return mmap_decommitted_from_system(size, size);
+}
+
 // Free a memory region [ptr, ptr + size) to the system. |ptr| and |size| needs
 // to be a multiple of 4096 bytes.
 void munmap_to_system(void *ptr, size_t size) {
@@ -403,7 +1459,129 @@ void munmap_to_system(void *ptr, size_t size) {
   assert(ret != -1);
 }
 
+// Return the physical pages backing [ptr, ptr + size) to the system while
+// keeping the address range mapped. The range reads as zero-filled memory
+// when it is touched again, so the caller must report the reuse with
+// recommit_from_system() before handing any part of it out. |ptr| and |size|
+// needs to be a multiple of 4096 bytes.
+void madvise_to_system(void *ptr, size_t size) {
+  assert(size % 4096 == 0);
+  assert((uintptr_t)(ptr) % 4096 == 0);
+  stats.madvise_size += size;
+  // MADV_DONTNEED (rather than MADV_FREE) drops the pages immediately and
+  // guarantees zero-filled pages on the next touch, the same as fresh mmap.
+  int ret = madvise(ptr, size, MADV_DONTNEED);
+  if (trace_fp) {
+    fprintf(trace_fp, "d %llu %ld\n", (unsigned long long)ptr, size);
+  }
+  assert(ret != -1);
+}
+
+// Tell the system that a range previously passed to madvise_to_system() is
+// going to be used again. No system call is needed since the pages are
+// faulted back in on the first touch (unless --populate is given), but the
+// memory counts as used again.
+// |ptr| and |size| needs to be a multiple of 4096 bytes.
+void recommit_from_system(void *ptr, size_t size) {
+  assert(size % 4096 == 0);
+  assert((uintptr_t)(ptr) % 4096 == 0);
+  assert(stats.madvise_size >= size);
+  stats.madvise_size -= size;
+#ifdef MADV_POPULATE_WRITE
+  if (populate_pages) {
+    // Linux 5.14+. Older kernels fail with EINVAL, and the pages are faulted
+    // in on the first touch as usual.
+    size_t page_faults = get_page_faults();
+    madvise(ptr, size, MADV_POPULATE_WRITE);
+    stats.populate_faults += get_page_faults() - page_faults;
+  }
+#endif
+  if (trace_fp) {
+    fprintf(trace_fp, "c %llu %ld\n", (unsigned long long)ptr, size);
+  }
+}
+
 int main(int argc, char **argv) {
+  benchmark_options_t options = {0, 1, 12, OUTPUT_FORMAT_TEXT, {{0}, 0}, 0};
+  const char *workload_file_name = NULL;
+  int workload_scale = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--allocators") == 0 && i + 1 < argc) {
+      if (!parse_allocator_selection(argv[++i], &options.selection)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--seeds") == 0 && i + 1 < argc) {
+      options.seeds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      options.iterations = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--first-seed") == 0 && i + 1 < argc) {
+      options.first_seed = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "csv") == 0) {
+        options.format = OUTPUT_FORMAT_CSV;
+      } else if (strcmp(argv[i], "json") == 0) {
+        options.format = OUTPUT_FORMAT_JSON;
+      } else if (strcmp(argv[i], "text") == 0) {
+        options.format = OUTPUT_FORMAT_TEXT;
+      } else {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--workload") == 0 && i + 1 < argc) {
+      workload_file_name = argv[++i];
+    } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+      workload_scale = atoi(argv[++i]);
+      if (workload_scale < 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--populate") == 0) {
+      populate_pages = true;
+    } else if (strcmp(argv[i], "--isolate") == 0) {
+      options.jobs = options.jobs > 0 ? options.jobs : 1;
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      options.jobs = atoi(argv[++i]);
+      if (options.jobs < 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+      return compare_benchmarks(argv[i + 1], argv[i + 2]);
+    } else {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  int cpu_count = get_cpu_count();
+  if (cpu_count > 0 && options.jobs > cpu_count) {
+    // More children than CPUs would share CPUs and slow each other down.
+    fprintf(stderr, "Warning: --jobs %d is reduced to the %d available CPUs\n",
+            options.jobs, cpu_count);
+    options.jobs = cpu_count;
+  }
+  if (workload_file_name) {
+    if (options.selection.count == 0) {
+      parse_allocator_selection("my", &options.selection);
+    }
+    test();
+    return run_workloads(workload_file_name, workload_scale,
+                         &options.selection, options.jobs, options.first_seed);
+  }
+  if (options.seeds > 0) {
+    if (options.iterations < 1) {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    if (options.selection.count == 0) {
+      parse_allocator_selection("my", &options.selection);
+    }
+    test();
+    run_benchmark(&options);
+    return 0;
+  }
+
   srand(12);  // Set the rand seed to make the challenges non-deterministic.
   printf("Welcome to the malloc challenge!\n");
   printf("size_of(uint8_t *) = %ld\n", sizeof(uint8_t *));
@@ -411,6 +1589,9 @@ int main(int argc, char **argv) {
   printf("Running tests...\n");
   test();
   printf("Finished!\n\n");
-  run_challenges();
+  if (options.selection.count == 0) {
+    parse_allocator_selection("simple,my", &options.selection);
+  }
+  run_challenges(&options.selection, options.jobs, options.first_seed);
   return 0;
 }
@@ -13,28 +13,131 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+
+// The size classes generated from the challenge traces by
+// trace/size_class_optimizer.bin (run `make size_classes` in trace/).
+#include "my_size_classes.h"
 
 //
 // Interfaces to get memory pages from OS
 //
 
 void *mmap_from_system(size_t size);
+void *mmap_decommitted_from_system(size_t size, size_t committed_size);
 void munmap_to_system(void *ptr, size_t size);
+void madvise_to_system(void *ptr, size_t size);
+void recommit_from_system(void *ptr, size_t size);
 
 //
 // Struct definitions
 //
 
+// Every object and free slot begins with a one-word header which packs its
+// size (excluding the header) with the flags below. Only a free slot has
+// |next|, which overlaps the first bytes of what would be the object.
+//
+// ... | header | object          | header | next | free slot  | ...
+//     ^        ^                 ^
+//     metadata ptr               metadata
 typedef struct my_metadata_t {
-  size_t size;
+  size_t header;
   struct my_metadata_t *next;
 } my_metadata_t;
 
+#define MY_HEADER_SIZE sizeof(size_t)
+// The object is allocated, or is in a quick list. The other low bits are
+// free since sizes are multiples of 8 bytes.
+#define MY_IN_USE ((size_t)1)
+#define MY_FLAGS ((size_t)7)
+
+// Requests of up to this size are rounded up to their size class (see
+// my_size_classes.h), and the freed objects are kept in per-class quick lists
+// instead of being merged into the free list right away.
+#define MY_QUICK_LIST_MAX_SIZE 512
+#define MY_NUM_QUICK_LISTS MY_NUM_SIZE_CLASSES
+// |size_class_of[size / 8]| has no class for sizes above the largest class
+// of up to MY_QUICK_LIST_MAX_SIZE bytes.
+#define MY_NO_SIZE_CLASS 0xff
+// The quick lists are consolidated into the free list before they hold more
+// than 1/MY_QUICK_LIST_MAX_FRACTION of the chunks, which bounds the
+// fragmentation. The bound grows with the heap, so the cost of walking the
+// free list at each consolidation stays small per object.
+#define MY_QUICK_LIST_MAX_FRACTION 16
+
+// Every chunk begins with this header, followed by its objects and free
+// slots. Free slots are never merged across chunks, so a chunk whose objects
+// are all freed is one free slot and can be returned to the system. The
+// header is one word like the headers of the objects, so every object is
+// 8-byte aligned, which is the alignment the challenges ask for.
+//   *  |live_size| is the size of the objects (including their headers) in
+//      the chunk. Objects in quick lists count as live.
+typedef struct my_chunk_t {
+  size_t live_size;
+} my_chunk_t;
+
+// The page map is a radix tree which maps the number of each page to the
+// chunk which owns it. A 48-bit address has a 36-bit page number, which is
+// split into four levels of 9 bits like the page table of x86-64, so every
+// node is one page.
+#define MY_PAGE_MAP_LEVELS 4
+#define MY_PAGE_MAP_BITS 9
+#define MY_PAGE_MAP_FANOUT (1 << MY_PAGE_MAP_BITS)
+
+// An inner node of the page map points to its children, and a leaf holds the
+// beginning of the chunk which owns each page (0 if the page is not ours).
+typedef struct my_page_map_node_t {
+  uintptr_t entries[MY_PAGE_MAP_FANOUT];
+} my_page_map_node_t;
+
+// The global information of my malloc.
+//   *  |free_head| points to the free list sorted by address.
+//   *  |dummy| is a dummy free slot at the head of the free list.
+//   *  |quick_lists[class]| is a LIFO list of freed objects of at least
+//      my_size_classes[class] bytes linked with |next|. They still look
+//      allocated to their neighbors, so they are neither split nor merged
+//      until they are consolidated into the free list.
+//   *  |size_class_of[size / 8]| is the smallest size class which can hold
+//      |size| bytes, or MY_NO_SIZE_CLASS.
+//   *  |page_map| is the root of the page map (see my_page_map_entry()).
+//   *  |quick_list_size| is the size of the objects (including their
+//      headers) in the quick lists.
+//   *  |chunk_count| is the number of chunks, and |empty_chunk_count| is the
+//      number of chunks with no live object.
+//   *  |alloc_chunk| is the chunk my_malloc() carved an object from most
+//      recently, or NULL.
 typedef struct my_heap_t {
   my_metadata_t *free_head;
   my_metadata_t dummy;
+  my_metadata_t *quick_lists[MY_NUM_QUICK_LISTS];
+  size_t quick_list_size;
+  unsigned char size_class_of[MY_QUICK_LIST_MAX_SIZE / 8 + 1];
+  struct my_page_map_node_t *page_map[MY_PAGE_MAP_FANOUT];
+  size_t chunk_count;
+  size_t empty_chunk_count;
+  struct my_chunk_t *alloc_chunk;
 } my_heap_t;
 
+// Memory is requested from the system in chunks of this size. A chunk is
+// carved into objects and free slots, and free slots are merged back together
+// when their neighbors are freed.
+#define MY_CHUNK_SIZE (64 * 1024)
+#define MY_PAGE_SIZE 4096
+// A free slot whose interior spans at least this many pages has those pages
+// returned to the system with madvise_to_system(). Smaller slots are kept
+// committed since they are likely to be reused soon.
+#define MY_DECOMMIT_MIN_PAGES 4
+// my_malloc() looks at this many free slots the object fits in, and takes
+// the one in the fullest chunk, so that the other chunks can drain.
+#define MY_PLACEMENT_CANDIDATES 4
+// A chunk with less live objects than this is draining unless my_malloc() is
+// carving objects from it: the objects freed in it skip the quick lists so
+// that the chunk can become empty.
+#define MY_DRAIN_LIVE_SIZE (MY_CHUNK_SIZE / 4)
+// Empty chunks are kept (with their pages decommitted) up to this number to
+// avoid mapping them again right away. The rest are unmapped.
+#define MY_MAX_EMPTY_CHUNKS 1
+
 //
 // Static variables (DO NOT ADD ANOTHER STATIC VARIABLES!)
 //
@@ -44,10 +147,114 @@ my_heap_t my_heap;
 // Helper functions (feel free to add/remove/edit!)
 //
 
-void my_add_to_free_list(my_metadata_t *metadata) {
-  assert(!metadata->next);
-  metadata->next = my_heap.free_head;
-  my_heap.free_head = metadata;
+size_t my_size_of(my_metadata_t *metadata) {
+  return metadata->header & ~MY_FLAGS;
+}
+
+void my_set_size(my_metadata_t *metadata, size_t size) {
+  metadata->header = size | (metadata->header & MY_FLAGS);
+}
+
+// Return the address right after the free slot or object |metadata|.
+uintptr_t my_end_of(my_metadata_t *metadata) {
+  return (uintptr_t)metadata + MY_HEADER_SIZE + my_size_of(metadata);
+}
+
+// Return the entry of the page map for the page of |address|. The nodes on
+// the way are created if |create| is true, otherwise NULL is returned if
+// there is none.
+uintptr_t *my_page_map_entry(uintptr_t address, bool create) {
+  uintptr_t page = address / MY_PAGE_SIZE;
+  int shift = (MY_PAGE_MAP_LEVELS - 1) * MY_PAGE_MAP_BITS;
+  assert((page >> shift) < MY_PAGE_MAP_FANOUT);
+  uintptr_t *entry = (uintptr_t *)&my_heap.page_map[page >> shift];
+  while (shift > 0) {
+    shift -= MY_PAGE_MAP_BITS;
+    if (!*entry) {
+      if (!create) {
+        return NULL;
+      }
+      // Fresh pages from the system are zero-filled, i.e. empty entries.
+      *entry = (uintptr_t)mmap_from_system(sizeof(my_page_map_node_t));
+    }
+    entry = &((my_page_map_node_t *)*entry)
+                 ->entries[(page >> shift) & (MY_PAGE_MAP_FANOUT - 1)];
+  }
+  return entry;
+}
+
+// Return the beginning of the chunk which owns |address|, or 0 if it is not
+// a part of my heap.
+uintptr_t my_page_map_lookup(uintptr_t address) {
+  uintptr_t *entry = my_page_map_entry(address, false);
+  return entry ? *entry : 0;
+}
+
+// Record that the pages of [chunk, chunk + size) are owned by |owner|, which
+// is |chunk| or 0 if the chunk is returned to the system.
+void my_page_map_set(void *chunk, size_t size, uintptr_t owner) {
+  for (size_t offset = 0; offset < size; offset += MY_PAGE_SIZE) {
+    *my_page_map_entry((uintptr_t)chunk + offset, true) = owner;
+  }
+}
+
+// Return |node| of the page map and the nodes under it to the system.
+// |height| is the number of levels of nodes under |node| (0 for a leaf).
+// This is only called from my_finalize(), and the stats of the challenge are
+// read after that, so the nodes are released with munmap() directly instead
+// of munmap_to_system() to keep them counted, the same as bump_finalize().
+void my_page_map_release(my_page_map_node_t *node, int height) {
+  for (int i = 0; height > 0 && i < MY_PAGE_MAP_FANOUT; i++) {
+    if (node->entries[i]) {
+      my_page_map_release((my_page_map_node_t *)node->entries[i], height - 1);
+    }
+  }
+  int ret = munmap(node, sizeof(my_page_map_node_t));
+  assert(ret != -1);
+  (void)ret;
+}
+
+// Return the chunk which owns the free slot or object |metadata|.
+my_chunk_t *my_chunk_of(my_metadata_t *metadata) {
+  return (my_chunk_t *)my_page_map_lookup((uintptr_t)metadata);
+}
+
+// Compute the interior pages [*begin, *end) of a free slot, i.e. the pages
+// that lie entirely inside the slot and do not hold its header or |next|.
+//
+// ... | metadata | free slot            | ...
+//                 <-->|page|page|page|<->
+//                     ^              ^
+//                     *begin         *end
+void my_interior_pages(my_metadata_t *metadata, uintptr_t *begin,
+                       uintptr_t *end) {
+  *begin = ((uintptr_t)(metadata + 1) + MY_PAGE_SIZE - 1) &
+           ~(uintptr_t)(MY_PAGE_SIZE - 1);
+  *end = my_end_of(metadata) & ~(uintptr_t)(MY_PAGE_SIZE - 1);
+  if (*end < *begin) {
+    *end = *begin;
+  }
+}
+
+// Return true if the interior pages of the free slot |metadata| are large
+// enough to be decommitted. Every free slot in the free list satisfies:
+// the interior pages are decommitted if and only if this returns true.
+bool my_is_decommitted(my_metadata_t *metadata) {
+  uintptr_t begin, end;
+  my_interior_pages(metadata, &begin, &end);
+  return end - begin >= MY_DECOMMIT_MIN_PAGES * MY_PAGE_SIZE;
+}
+
+void my_decommit_range(uintptr_t begin, uintptr_t end) {
+  if (begin < end) {
+    madvise_to_system((void *)begin, end - begin);
+  }
+}
+
+void my_recommit_range(uintptr_t begin, uintptr_t end) {
+  if (begin < end) {
+    recommit_from_system((void *)begin, end - begin);
+  }
 }
 
 void my_remove_from_free_list(my_metadata_t *metadata, my_metadata_t *prev) {
@@ -56,7 +263,164 @@ void my_remove_from_free_list(my_metadata_t *metadata, my_metadata_t *prev) {
   } else {
     my_heap.free_head = metadata->next;
   }
-  metadata->next = NULL;
+}
+
+// Return the empty |chunk| to the system. Its only free slot |metadata|
+// follows |prev| in the free list.
+void my_release_chunk(my_chunk_t *chunk, my_metadata_t *metadata,
+                      my_metadata_t *prev) {
+  assert(chunk->live_size == 0 && (uintptr_t)(chunk + 1) == (uintptr_t)metadata);
+  my_remove_from_free_list(metadata, prev);
+  if (my_is_decommitted(metadata)) {
+    // munmap_to_system() counts the whole chunk as returned.
+    uintptr_t begin, end;
+    my_interior_pages(metadata, &begin, &end);
+    my_recommit_range(begin, end);
+  }
+  my_page_map_set(chunk, MY_CHUNK_SIZE, 0);
+  munmap_to_system(chunk, MY_CHUNK_SIZE);
+  my_heap.chunk_count--;
+  if (my_heap.alloc_chunk == chunk) {
+    my_heap.alloc_chunk = NULL;
+  }
+}
+
+// Add a free slot to the free list. The free list is sorted by address so
+// that the slot can be merged with the free slots right before and after it.
+// If the merged slot is large enough, its interior pages are decommitted.
+// If |metadata| is an object which was the last live one of its chunk, the
+// chunk may be returned to the system.
+// The search for its position starts from |hint|, which is the head of the
+// free list or a free slot before |metadata|. Returns the free slot (or the
+// head) right before the merged slot, which is a valid hint for any address
+// after |metadata|.
+my_metadata_t *my_add_to_free_list(my_metadata_t *metadata,
+                                   my_metadata_t *hint) {
+  my_chunk_t *chunk = my_chunk_of(metadata);
+  bool is_object = metadata->header & MY_IN_USE;
+  if (is_object) {
+    chunk->live_size -= MY_HEADER_SIZE + my_size_of(metadata);
+  }
+  metadata->header &= ~MY_IN_USE;
+  my_metadata_t *prev_prev = NULL;
+  my_metadata_t *prev = hint;
+  while (prev->next && prev->next < metadata) {
+    prev_prev = prev;
+    prev = prev->next;
+  }
+  my_metadata_t *next = prev->next;
+  // [committed_begin, committed_end) is the part of the merged slot which may
+  // still be backed by physical pages. The interior pages outside of it have
+  // already been decommitted as a part of |prev| or |next|.
+  uintptr_t committed_begin = (uintptr_t)metadata;
+  uintptr_t committed_end = my_end_of(metadata);
+  uintptr_t begin, end;
+
+  if (next && my_end_of(metadata) == (uintptr_t)next) {
+    // ... | metadata | free slot | next | free slot | ...
+    if (my_is_decommitted(next)) {
+      my_interior_pages(next, &begin, &end);
+      committed_end = begin;
+    } else {
+      committed_end = my_end_of(next);
+    }
+    my_set_size(metadata,
+                my_size_of(metadata) + MY_HEADER_SIZE + my_size_of(next));
+    next = next->next;
+  }
+  bool merges_with_prev =
+      prev != &my_heap.dummy && my_end_of(prev) == (uintptr_t)metadata;
+  assert(!merges_with_prev || prev_prev);
+  if (merges_with_prev) {
+    // ... | prev | free slot | metadata | free slot | ...
+    if (my_is_decommitted(prev)) {
+      my_interior_pages(prev, &begin, &end);
+      committed_begin = end;
+    } else {
+      committed_begin = (uintptr_t)prev;
+    }
+    my_set_size(prev,
+                my_size_of(prev) + MY_HEADER_SIZE + my_size_of(metadata));
+    prev->next = next;
+    metadata = prev;
+    prev = prev_prev;
+  } else {
+    metadata->next = next;
+    prev->next = metadata;
+  }
+
+  if (is_object && chunk->live_size == 0 &&
+      my_heap.empty_chunk_count >= MY_MAX_EMPTY_CHUNKS) {
+    my_release_chunk(chunk, metadata, prev);
+    return prev;
+  }
+  if (my_is_decommitted(metadata)) {
+    my_interior_pages(metadata, &begin, &end);
+    my_decommit_range(committed_begin > begin ? committed_begin : begin,
+                      committed_end < end ? committed_end : end);
+  }
+  if (is_object && chunk->live_size == 0) {
+    my_heap.empty_chunk_count++;
+  }
+  return prev;
+}
+
+// Sort a list of objects linked with |next| by address (merge sort).
+my_metadata_t *my_sort_by_address(my_metadata_t *list) {
+  if (!list || !list->next) {
+    return list;
+  }
+  // Split the list in halves at |middle|.
+  my_metadata_t *middle = list;
+  for (my_metadata_t *fast = list->next; fast && fast->next;
+       fast = fast->next->next) {
+    middle = middle->next;
+  }
+  my_metadata_t *second = my_sort_by_address(middle->next);
+  middle->next = NULL;
+  my_metadata_t *first = my_sort_by_address(list);
+  my_metadata_t head;
+  my_metadata_t *tail = &head;
+  while (first && second) {
+    if (first < second) {
+      tail->next = first;
+      first = first->next;
+    } else {
+      tail->next = second;
+      second = second->next;
+    }
+    tail = tail->next;
+  }
+  tail->next = first ? first : second;
+  return head.next;
+}
+
+// Move every object in the quick lists to the free list, merging them with
+// their free neighbors. The objects are sorted by address first, so that the
+// free list is walked once for all of them rather than once per object.
+// Returns true if any object was moved.
+bool my_consolidate_quick_lists() {
+  my_metadata_t *list = NULL;
+  for (int i = 0; i < MY_NUM_QUICK_LISTS; i++) {
+    while (my_heap.quick_lists[i]) {
+      my_metadata_t *metadata = my_heap.quick_lists[i];
+      my_heap.quick_lists[i] = metadata->next;
+      metadata->next = list;
+      list = metadata;
+    }
+  }
+  my_heap.quick_list_size = 0;
+  if (!list) {
+    return false;
+  }
+  my_metadata_t *hint = my_heap.free_head;
+  list = my_sort_by_address(list);
+  while (list) {
+    my_metadata_t *next = list->next;
+    hint = my_add_to_free_list(list, hint);
+    list = next;
+  }
+  return true;
 }
 
 //
@@ -66,41 +430,118 @@ void my_remove_from_free_list(my_metadata_t *metadata, my_metadata_t *prev) {
 // This is called at the beginning of each challenge.
 void my_initialize() {
   my_heap.free_head = &my_heap.dummy;
-  my_heap.dummy.size = 0;
+  my_heap.dummy.header = 0;
   my_heap.dummy.next = NULL;
+  for (int i = 0; i < MY_NUM_QUICK_LISTS; i++) {
+    my_heap.quick_lists[i] = NULL;
+  }
+  my_heap.quick_list_size = 0;
+  int size_class = 0;
+  for (size_t size = 0; size <= MY_QUICK_LIST_MAX_SIZE; size += 8) {
+    while (size_class < MY_NUM_SIZE_CLASSES &&
+           my_size_classes[size_class] < size) {
+      size_class++;
+    }
+    my_heap.size_class_of[size / 8] =
+        size_class < MY_NUM_SIZE_CLASSES &&
+                my_size_classes[size_class] <= MY_QUICK_LIST_MAX_SIZE
+            ? size_class
+            : MY_NO_SIZE_CLASS;
+  }
+  for (int i = 0; i < MY_PAGE_MAP_FANOUT; i++) {
+    my_heap.page_map[i] = NULL;
+  }
+  my_heap.chunk_count = 0;
+  my_heap.empty_chunk_count = 0;
+  my_heap.alloc_chunk = NULL;
 }
 
 // my_malloc() is called every time an object is allocated.
 // |size| is guaranteed to be a multiple of 8 bytes and meets 8 <= |size| <=
 // 4000. You are not allowed to use any library functions other than
-// mmap_from_system() / munmap_to_system().
+// mmap_from_system() / munmap_to_system() / madvise_to_system() /
+// recommit_from_system().
 void *my_malloc(size_t size) {
-  my_metadata_t *metadata = my_heap.free_head;
+  int size_class = size <= MY_QUICK_LIST_MAX_SIZE
+                       ? my_heap.size_class_of[size / 8]
+                       : MY_NO_SIZE_CLASS;
+  if (size_class != MY_NO_SIZE_CLASS) {
+    // Objects of the same class are interchangeable.
+    size = my_size_classes[size_class];
+    if (my_heap.quick_lists[size_class]) {
+      // Fast path: reuse the object freed most recently in the class.
+      my_metadata_t *metadata = my_heap.quick_lists[size_class];
+      my_heap.quick_lists[size_class] = metadata->next;
+      my_heap.quick_list_size -= MY_HEADER_SIZE + my_size_of(metadata);
+      return (char *)metadata + MY_HEADER_SIZE;
+    }
+  }
+
+  // Occupancy-aware fit: Among the first MY_PLACEMENT_CANDIDATES free slots
+  // the object fits, take the one in the chunk with the most live objects.
+  // Allocating from the fullest chunks lets the emptier ones drain, so that
+  // their pages can be decommitted or the whole chunk can be unmapped.
+  my_metadata_t *metadata = NULL;
   my_metadata_t *prev = NULL;
-  // First-fit: Find the first free slot the object fits.
-  // TODO: Update this logic to Best-fit!
-  while (metadata && metadata->size < size) {
-    prev = metadata;
-    metadata = metadata->next;
+  size_t live_size = 0;
+  int candidates = 0;
+  my_metadata_t *candidate_prev = NULL;
+  for (my_metadata_t *candidate = my_heap.free_head;
+       candidate && candidates < MY_PLACEMENT_CANDIDATES;
+       candidate_prev = candidate, candidate = candidate->next) {
+    if (my_size_of(candidate) < size) {
+      continue;
+    }
+    candidates++;
+    size_t candidate_live_size = my_chunk_of(candidate)->live_size;
+    if (!metadata || candidate_live_size > live_size) {
+      metadata = candidate;
+      prev = candidate_prev;
+      live_size = candidate_live_size;
+    }
   }
-  // now, metadata points to the first free slot
+  // now, metadata points to the chosen free slot
   // and prev is the previous entry.
 
+  if (!metadata && my_consolidate_quick_lists()) {
+    // The objects in the quick lists may merge into a large enough slot.
+    return my_malloc(size);
+  }
+
   if (!metadata) {
     // There was no free slot available. We need to request a new memory region
     // from the system by calling mmap_from_system().
     //
-    //     | metadata | free slot |
-    //     ^
-    //     metadata
-    //     <---------------------->
-    //            buffer_size
-    size_t buffer_size = 4096;
-    my_metadata_t *metadata = (my_metadata_t *)mmap_from_system(buffer_size);
-    metadata->size = buffer_size - sizeof(my_metadata_t);
-    metadata->next = NULL;
-    // Add the memory region to the free list.
-    my_add_to_free_list(metadata);
+    //     | chunk | metadata | free slot |
+    //     ^       ^
+    //     chunk   metadata
+    //     <------------------------------>
+    //                buffer_size
+    //
+    // The interior pages of the free slot are decommitted as the free list
+    // requires. They have never been touched, so they are mapped as
+    // decommitted rather than passed to madvise_to_system().
+    size_t buffer_size = MY_CHUNK_SIZE;
+    size_t committed_size =
+        (sizeof(my_chunk_t) + sizeof(my_metadata_t) + MY_PAGE_SIZE - 1) &
+        ~(size_t)(MY_PAGE_SIZE - 1);
+    my_chunk_t *chunk =
+        (my_chunk_t *)mmap_decommitted_from_system(buffer_size, committed_size);
+    my_page_map_set(chunk, buffer_size, (uintptr_t)chunk);
+    chunk->live_size = 0;
+    my_heap.chunk_count++;
+    my_heap.empty_chunk_count++;
+    my_metadata_t *metadata = (my_metadata_t *)(chunk + 1);
+    metadata->header = buffer_size - sizeof(my_chunk_t) - MY_HEADER_SIZE;
+    assert(my_is_decommitted(metadata));
+    // Add the memory region to the free list. A new chunk has no free
+    // neighbor to merge with.
+    my_metadata_t *prev = my_heap.free_head;
+    while (prev->next && prev->next < metadata) {
+      prev = prev->next;
+    }
+    metadata->next = prev->next;
+    prev->next = metadata;
     // Now, try my_malloc() again. This should succeed.
     return my_malloc(size);
   }
@@ -110,18 +551,22 @@ void *my_malloc(size_t size) {
   // ... | metadata | object | ...
   //     ^          ^
   //     metadata   ptr
-  void *ptr = metadata + 1;
-  size_t remaining_size = metadata->size - size;
+  void *ptr = (char *)metadata + MY_HEADER_SIZE;
+  size_t remaining_size = my_size_of(metadata) - size;
+  bool decommitted = my_is_decommitted(metadata);
+  uintptr_t begin, end;
+  my_interior_pages(metadata, &begin, &end);
   // Remove the free slot from the free list.
   my_remove_from_free_list(metadata, prev);
 
-  if (remaining_size > sizeof(my_metadata_t)) {
+  metadata->header |= MY_IN_USE;
+  if (remaining_size >= MY_HEADER_SIZE + my_size_classes[0]) {
     // Shrink the metadata for the allocated object
     // to separate the rest of the region corresponding to remaining_size.
-    // If the remaining_size is not large enough to make a new metadata,
-    // this code path will not be taken and the region will be managed
-    // as a part of the allocated object.
-    metadata->size = size;
+    // If the remaining_size is not large enough to make a new metadata and
+    // hold an object of the smallest size class, this code path will not be
+    // taken and the region will be managed as a part of the allocated object.
+    my_set_size(metadata, size);
     // Create a new metadata for the remaining free slot.
     //
     // ... | metadata | object | metadata | free slot | ...
@@ -130,34 +575,328 @@ void *my_malloc(size_t size) {
     //                 <------><---------------------->
     //                   size       remaining size
     my_metadata_t *new_metadata = (my_metadata_t *)((char *)ptr + size);
-    new_metadata->size = remaining_size - sizeof(my_metadata_t);
-    new_metadata->next = NULL;
-    // Add the remaining free slot to the free list.
-    my_add_to_free_list(new_metadata);
+    if (decommitted) {
+      // The pages given to the object and the page holding |new_metadata| are
+      // used again, so they are recommitted before anything is written there.
+      // The rest stays decommitted only if the remaining free slot, which
+      // ends where the old one did, is still large enough.
+      uintptr_t new_begin = ((uintptr_t)(new_metadata + 1) + MY_PAGE_SIZE - 1) &
+                            ~(uintptr_t)(MY_PAGE_SIZE - 1);
+      bool still_decommitted =
+          new_begin < end &&
+          end - new_begin >= MY_DECOMMIT_MIN_PAGES * MY_PAGE_SIZE;
+      my_recommit_range(begin, still_decommitted ? new_begin : end);
+    }
+    new_metadata->header = remaining_size - MY_HEADER_SIZE;
+    // The remaining free slot takes over the position of |metadata| in the
+    // free list, which keeps the list sorted by address. Its neighbors are
+    // not free (otherwise they would have been merged), so there is nothing
+    // to merge.
+    new_metadata->next = prev->next;
+    prev->next = new_metadata;
+  } else {
+    if (decommitted) {
+      my_recommit_range(begin, end);
+    }
+  }
+  my_chunk_t *chunk = my_chunk_of(metadata);
+  if (chunk->live_size == 0) {
+    my_heap.empty_chunk_count--;
   }
+  chunk->live_size += MY_HEADER_SIZE + my_size_of(metadata);
+  my_heap.alloc_chunk = chunk;
   return ptr;
 }
 
 // This is called every time an object is freed.  You are not allowed to
-// use any library functions other than mmap_from_system / munmap_to_system.
+// use any library functions other than mmap_from_system / munmap_to_system /
+// madvise_to_system / recommit_from_system.
 void my_free(void *ptr) {
   // Look up the metadata. The metadata is placed just prior to the object.
   //
   // ... | metadata | object | ...
   //     ^          ^
   //     metadata   ptr
-  my_metadata_t *metadata = (my_metadata_t *)ptr - 1;
-  // Add the free slot to the free list.
-  my_add_to_free_list(metadata);
+  my_metadata_t *metadata = (my_metadata_t *)((char *)ptr - MY_HEADER_SIZE);
+  // The page map tells whether |ptr| is in my heap at all, without reading
+  // anything from the object.
+  my_chunk_t *chunk = my_chunk_of(metadata);
+  assert(chunk);
+  assert(metadata->header & MY_IN_USE);
+  size_t size = my_size_of(metadata);
+  int index = size <= MY_QUICK_LIST_MAX_SIZE ? my_heap.size_class_of[size / 8]
+                                             : MY_NO_SIZE_CLASS;
+  if (index != MY_NO_SIZE_CLASS && my_size_classes[index] > size) {
+    // The object is larger than its class because the rest of its slot was
+    // too small to split, so it goes to the largest class it can serve.
+    index--;
+  }
+  if (index != MY_NO_SIZE_CLASS && index >= 0 &&
+      (chunk->live_size >= MY_DRAIN_LIVE_SIZE ||
+       chunk == my_heap.alloc_chunk)) {
+    // Push the object to the quick list of its class. Merging it with its
+    // neighbors is deferred until the quick list is consolidated. Objects in
+    // a draining chunk go to the free list instead, since a quick list would
+    // hand them out again and keep the chunk alive. The chunk my_malloc() is
+    // carving from is not draining, so a small heap still takes the fast
+    // path.
+    if (my_heap.quick_list_size + MY_HEADER_SIZE + size >
+        my_heap.chunk_count * MY_CHUNK_SIZE / MY_QUICK_LIST_MAX_FRACTION) {
+      my_consolidate_quick_lists();
+    }
+    metadata->next = my_heap.quick_lists[index];
+    my_heap.quick_lists[index] = metadata;
+    my_heap.quick_list_size += MY_HEADER_SIZE + size;
+    return;
+  }
+  // Add the free slot to the free list, merging it with its neighbors.
+  my_add_to_free_list(metadata, my_heap.free_head);
 }
 
 // This is called at the end of each challenge.
 void my_finalize() {
-  // Nothing is here for now.
-  // feel free to add something if you want!
+  // The chunks may still hold objects which are never freed, but nothing
+  // looks them up any more, so the page map is returned to the system. Its
+  // pages stay in the stats of the challenge (see my_page_map_release()).
+  for (int i = 0; i < MY_PAGE_MAP_FANOUT; i++) {
+    if (my_heap.page_map[i]) {
+      my_page_map_release(my_heap.page_map[i], MY_PAGE_MAP_LEVELS - 2);
+      my_heap.page_map[i] = NULL;
+    }
+  }
+}
+
+//
+// Arenas
+//
+// An arena hands out objects by bumping a pointer through its chunks, and
+// frees all of them at once with my_arena_reset(). Nothing is freed one by
+// one, so objects that die together (e.g. the ones freed in the same epoch)
+// are cheap to allocate and to release.
+//
+// The state of an arena lives in its first chunk, so no static variable is
+// needed. The chunks are kept when the arena is reset, but their pages are
+// decommitted, so a reset arena holds only one page per chunk.
+//
+
+#define MY_ARENA_CHUNK_SIZE (64 * 1024)
+
+// The header of a chunk of an arena.
+//   *  |size| is the size of the chunk including this header.
+//   *  [|committed_end|, end of the chunk) is decommitted.
+typedef struct my_arena_chunk_t {
+  struct my_arena_chunk_t *next;
+  size_t size;
+  uintptr_t committed_end;
+} my_arena_chunk_t;
+
+// |first| is the chunk which holds this struct, and [|cur|, |end|) is the
+// unused part of |current|. The chunks after |current| are all decommitted.
+typedef struct my_arena_t {
+  my_arena_chunk_t *first;
+  my_arena_chunk_t *current;
+  char *cur;
+  char *end;
+} my_arena_t;
+
+// Map a chunk which can hold an object of |size| bytes.
+my_arena_chunk_t *my_arena_map_chunk(size_t size) {
+  size_t chunk_size = (sizeof(my_arena_chunk_t) + size + MY_ARENA_CHUNK_SIZE -
+                       1) / MY_ARENA_CHUNK_SIZE * MY_ARENA_CHUNK_SIZE;
+  my_arena_chunk_t *chunk = (my_arena_chunk_t *)mmap_from_system(chunk_size);
+  chunk->next = NULL;
+  chunk->size = chunk_size;
+  chunk->committed_end = (uintptr_t)chunk + chunk_size;
+  return chunk;
+}
+
+// Return the beginning of the objects in |chunk| of |arena|.
+char *my_arena_chunk_begin(my_arena_t *arena, my_arena_chunk_t *chunk) {
+  return chunk == arena->first ? (char *)(arena + 1) : (char *)(chunk + 1);
+}
+
+my_arena_t *my_arena_create() {
+  my_arena_chunk_t *chunk = my_arena_map_chunk(sizeof(my_arena_t));
+  my_arena_t *arena = (my_arena_t *)(chunk + 1);
+  arena->first = arena->current = chunk;
+  arena->cur = (char *)(arena + 1);
+  arena->end = (char *)chunk + chunk->size;
+  return arena;
+}
+
+void *my_arena_alloc(my_arena_t *arena, size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  if ((size_t)(arena->end - arena->cur) < size) {
+    my_arena_chunk_t *next = arena->current->next;
+    if (!next || next->size - sizeof(my_arena_chunk_t) < size) {
+      // No chunk kept from before is large enough. Insert a new one right
+      // after the current chunk.
+      my_arena_chunk_t *chunk = my_arena_map_chunk(size);
+      chunk->next = next;
+      arena->current->next = chunk;
+      next = chunk;
+    }
+    arena->current = next;
+    arena->cur = (char *)(next + 1);
+    arena->end = (char *)next + next->size;
+  }
+  void *ptr = arena->cur;
+  arena->cur += size;
+  uintptr_t committed_end =
+      ((uintptr_t)arena->cur + MY_PAGE_SIZE - 1) & ~(uintptr_t)(MY_PAGE_SIZE - 1);
+  if (arena->current->committed_end < committed_end) {
+    my_recommit_range(arena->current->committed_end, committed_end);
+    arena->current->committed_end = committed_end;
+  }
+  return ptr;
+}
+
+// Free every object allocated from |arena|. This decommits the used pages of
+// each chunk with one madvise_to_system() call and does not look at the
+// objects themselves.
+void my_arena_reset(my_arena_t *arena) {
+  my_arena_chunk_t *chunk = arena->first;
+  while (chunk) {
+    // The first page holds the header of the chunk, so it is kept.
+    uintptr_t begin =
+        ((uintptr_t)my_arena_chunk_begin(arena, chunk) + MY_PAGE_SIZE - 1) &
+        ~(uintptr_t)(MY_PAGE_SIZE - 1);
+    if (begin < chunk->committed_end) {
+      my_decommit_range(begin, chunk->committed_end);
+      chunk->committed_end = begin;
+    }
+    if (chunk == arena->current) {
+      break;
+    }
+    chunk = chunk->next;
+  }
+  arena->current = arena->first;
+  arena->cur = my_arena_chunk_begin(arena, arena->first);
+  arena->end = (char *)arena->first + arena->first->size;
+}
+
+// Return every chunk of |arena| to the system. |arena| can not be used after
+// this.
+void my_arena_destroy(my_arena_t *arena) {
+  my_arena_chunk_t *chunk = arena->first;
+  while (chunk) {
+    my_arena_chunk_t *next = chunk->next;
+    my_recommit_range(chunk->committed_end, (uintptr_t)chunk + chunk->size);
+    munmap_to_system(chunk, chunk->size);
+    chunk = next;
+  }
+}
+
+//
+// Tests
+//
+
+// Check the headers of objects and free slots, and that freed objects of the
+// quick lists are handed out again, the most recently freed first.
+void my_test_heap() {
+  my_initialize();
+  char *guard = (char *)my_malloc(4000);
+  char *object = (char *)my_malloc(4000);
+  char *next_guard = (char *)my_malloc(4000);
+  // All three are carved one after another from the slot of a new chunk.
+  assert(object == guard + 4000 + MY_HEADER_SIZE);
+  assert(next_guard == object + 4000 + MY_HEADER_SIZE);
+  my_metadata_t *metadata = (my_metadata_t *)(object - MY_HEADER_SIZE);
+  assert((metadata->header & MY_FLAGS) == MY_IN_USE);
+  assert(my_size_of(metadata) == 4000);
+  // The neighbors are in use, so the object becomes a free slot of its own.
+  my_free(object);
+  assert((metadata->header & MY_FLAGS) == 0);
+  assert(my_size_of(metadata) == 4000);
+  assert(my_malloc(4000) == object);
+
+  // A small request is rounded up to its size class.
+  char *small = (char *)my_malloc(24);
+  my_metadata_t *small_metadata = (my_metadata_t *)(small - MY_HEADER_SIZE);
+  assert(my_size_of(small_metadata) ==
+         my_size_classes[my_heap.size_class_of[24 / 8]]);
+  // The object goes to a quick list and still looks allocated.
+  my_free(small);
+  assert(small_metadata->header & MY_IN_USE);
+  assert(my_heap.quick_list_size ==
+         MY_HEADER_SIZE + my_size_of(small_metadata));
+  assert(my_malloc(24) == small);
+  assert(my_heap.quick_list_size == 0);
+  char *other = (char *)my_malloc(24);
+  my_free(small);
+  my_free(other);
+  assert(my_malloc(24) == other);
+  assert(my_malloc(24) == small);
+  my_free(small);
+  my_free(other);
+  my_free(guard);
+  my_free(object);
+  my_free(next_guard);
+  my_finalize();
+}
+
+// Check that the page map finds the chunk of every object, nothing for other
+// addresses, and nothing for a chunk after it is returned to the system.
+void my_test_page_map() {
+  my_initialize();
+  char *first = (char *)my_malloc(4000);
+  my_chunk_t *first_chunk = my_chunk_of((my_metadata_t *)first);
+  assert(first_chunk);
+  assert((uintptr_t)first_chunk % MY_PAGE_SIZE == 0);
+  assert(my_page_map_lookup((uintptr_t)first_chunk + MY_CHUNK_SIZE - 1) ==
+         (uintptr_t)first_chunk);
+  assert(my_page_map_lookup((uintptr_t)&my_heap) == 0);
+  // Fill the first chunk until an object goes to a second one.
+  void *objects[MY_CHUNK_SIZE / 4000 + 2];
+  int count = 0;
+  objects[count++] = first;
+  char *last;
+  do {
+    last = (char *)my_malloc(4000);
+    objects[count++] = last;
+  } while (my_chunk_of((my_metadata_t *)last) == first_chunk);
+  my_chunk_t *last_chunk = my_chunk_of((my_metadata_t *)last);
+  assert(my_heap.chunk_count == 2);
+  // The first chunk to become empty is kept and the second one is unmapped.
+  for (int i = 0; i < count; i++) {
+    my_free(objects[i]);
+  }
+  assert(my_heap.chunk_count == 1 && my_heap.empty_chunk_count == 1);
+  assert(my_page_map_lookup((uintptr_t)first_chunk) == (uintptr_t)first_chunk);
+  assert(my_page_map_lookup((uintptr_t)last_chunk) == 0);
+  my_finalize();
+}
+
+// Check the bump allocation of arenas, that an oversize object gets its own
+// chunk, and that the chunks are kept and reused after a reset.
+void my_test_arena() {
+  my_arena_t *arena = my_arena_create();
+  char *object = (char *)my_arena_alloc(arena, 20);
+  assert((uintptr_t)object % 8 == 0);
+  assert((char *)my_arena_alloc(arena, 24) == object + 24);
+  my_arena_chunk_t *first = arena->current;
+
+  char *oversize = (char *)my_arena_alloc(arena, 2 * MY_ARENA_CHUNK_SIZE);
+  my_arena_chunk_t *oversize_chunk = arena->current;
+  assert(oversize_chunk != first && first->next == oversize_chunk);
+  assert(oversize == (char *)(oversize_chunk + 1));
+  assert(oversize_chunk->size >= 2 * MY_ARENA_CHUNK_SIZE);
+  memset(oversize, 1, 2 * MY_ARENA_CHUNK_SIZE);
+
+  my_arena_reset(arena);
+  assert(arena->current == first);
+  assert(oversize_chunk->committed_end <=
+         (uintptr_t)oversize_chunk + MY_PAGE_SIZE);
+  assert(my_arena_alloc(arena, 20) == object);
+  // The first chunk has no room left for this, so it goes to the chunk kept
+  // from before the reset rather than a new one.
+  assert(my_arena_alloc(arena, MY_ARENA_CHUNK_SIZE) == oversize);
+  assert(arena->current == oversize_chunk && first->next == oversize_chunk);
+  my_arena_destroy(arena);
 }
 
 void test() {
-  // Implement here!
-  assert(1 == 1); /* 1 is 1. That's always true! (You can remove this.) */
+  my_test_heap();
+  my_test_page_map();
+  my_test_arena();
 }
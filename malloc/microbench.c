@@ -0,0 +1,290 @@
+//
+// [Microbenchmarks of my malloc]
+//
+// Measures the throughput of my_malloc() / my_free() alone. The challenges
+// time rand(), log(), memset() and the bookkeeping of the objects along with
+// the allocator, and always free the objects in epoch order. Here every
+// scenario is generated into an array of ops before the clock starts, so the
+// timed loop does nothing but walk the array and call the allocator.
+//
+// Scenarios (each frees every object it allocates by the end):
+//   churn      Allocate a 64-byte object and free it right away.
+//   lifo       Allocate LIVE_OBJECTS objects, then free them newest first.
+//   fifo       Keep LIVE_OBJECTS objects alive; allocate one and free the
+//              oldest one at each step.
+//   random     Keep LIVE_OBJECTS objects alive; free a random one and
+//              allocate one in its place at each step.
+//   free_all   Allocate MANY_OBJECTS objects, then free all of them in the
+//              order they were allocated.
+// The sizes of all but churn follow the distribution of challenge 5.
+//
+// Usage: ./microbench.bin [--ops N] [--repeats N] [scenario...]
+//
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+void my_initialize();
+void *my_malloc(size_t size);
+void my_free(void *ptr);
+void my_finalize();
+
+#define LIVE_OBJECTS 1000
+#define MANY_OBJECTS 100000
+
+// Allocate an object of |size| bytes into |slots[slot]| if |size| is not 0,
+// otherwise free the object in |slots[slot]|.
+typedef struct op_t {
+  uint32_t slot;
+  uint32_t size;
+} op_t;
+
+typedef struct ops_t {
+  op_t *ops;
+  size_t count;
+  size_t capacity;
+  // The number of slots the ops refer to.
+  size_t num_slots;
+} ops_t;
+
+void push_op(ops_t *ops, uint32_t slot, uint32_t size) {
+  if (ops->count >= ops->capacity) {
+    ops->capacity = ops->capacity * 2 + 1024;
+    ops->ops = (op_t *)realloc(ops->ops, ops->capacity * sizeof(op_t));
+  }
+  ops->ops[ops->count++] = (op_t){slot, size};
+  if (slot >= ops->num_slots) {
+    ops->num_slots = slot + 1;
+  }
+}
+
+// Return a random number in [0, 1).
+double urand() { return rand() / ((double)RAND_MAX + 1); }
+
+// Return a size in [8, 4000] that follows the exponential distribution of
+// get_object_size() in main.c.
+uint32_t get_object_size() {
+  const double threshold = 6;
+  double tau = -log(urand());
+  if (tau >= threshold) {
+    tau = threshold;
+  }
+  return (uint32_t)((4000 - 8) * tau / threshold) / 8 * 8 + 8;
+}
+
+void generate_churn(ops_t *ops, size_t target) {
+  while (ops->count < target) {
+    push_op(ops, 0, 64);
+    push_op(ops, 0, 0);
+  }
+}
+
+void generate_lifo(ops_t *ops, size_t target) {
+  while (ops->count < target) {
+    for (uint32_t i = 0; i < LIVE_OBJECTS; i++) {
+      push_op(ops, i, get_object_size());
+    }
+    for (uint32_t i = LIVE_OBJECTS; i > 0; i--) {
+      push_op(ops, i - 1, 0);
+    }
+  }
+}
+
+void generate_fifo(ops_t *ops, size_t target) {
+  // The slots are used as a ring buffer, so the oldest object is always in
+  // the slot the next one goes to.
+  for (uint32_t i = 0; i < LIVE_OBJECTS; i++) {
+    push_op(ops, i, get_object_size());
+  }
+  for (uint32_t i = 0; ops->count < target; i = (i + 1) % LIVE_OBJECTS) {
+    push_op(ops, i, 0);
+    push_op(ops, i, get_object_size());
+  }
+  for (uint32_t i = 0; i < LIVE_OBJECTS; i++) {
+    push_op(ops, i, 0);
+  }
+}
+
+void generate_random(ops_t *ops, size_t target) {
+  for (uint32_t i = 0; i < LIVE_OBJECTS; i++) {
+    push_op(ops, i, get_object_size());
+  }
+  while (ops->count < target) {
+    uint32_t slot = (uint32_t)(urand() * LIVE_OBJECTS);
+    push_op(ops, slot, 0);
+    push_op(ops, slot, get_object_size());
+  }
+  for (uint32_t i = 0; i < LIVE_OBJECTS; i++) {
+    push_op(ops, i, 0);
+  }
+}
+
+void generate_free_all(ops_t *ops, size_t target) {
+  while (ops->count < target) {
+    for (uint32_t i = 0; i < MANY_OBJECTS; i++) {
+      push_op(ops, i, get_object_size());
+    }
+    for (uint32_t i = 0; i < MANY_OBJECTS; i++) {
+      push_op(ops, i, 0);
+    }
+  }
+}
+
+typedef struct scenario_t {
+  const char *name;
+  // Generate at least |target| ops into |ops|.
+  void (*generate)(ops_t *ops, size_t target);
+} scenario_t;
+
+const scenario_t scenarios[] = {
+    {"churn", generate_churn},   {"lifo", generate_lifo},
+    {"fifo", generate_fifo},     {"random", generate_random},
+    {"free_all", generate_free_all},
+};
+
+#define NUM_SCENARIOS ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+// Return the current time in nanoseconds.
+double get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Run |ops| once on a fresh heap and return the time it took in nanoseconds.
+double run_ops(ops_t *ops, void **slots) {
+  const op_t *op = ops->ops;
+  const op_t *end = ops->ops + ops->count;
+  my_initialize();
+  double begin = get_time_ns();
+  for (; op < end; op++) {
+    if (op->size) {
+      slots[op->slot] = my_malloc(op->size);
+    } else {
+      my_free(slots[op->slot]);
+    }
+  }
+  double elapsed = get_time_ns() - begin;
+  my_finalize();
+  return elapsed;
+}
+
+int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Run |scenario| |repeats| times after a warm up run and print the best and
+// the median time per op.
+void run_scenario(const scenario_t *scenario, size_t target, int repeats) {
+  ops_t ops = {NULL, 0, 0, 0};
+  srand(12);
+  scenario->generate(&ops, target);
+  void **slots = (void **)calloc(ops.num_slots, sizeof(void *));
+  double *samples = (double *)malloc(repeats * sizeof(double));
+  run_ops(&ops, slots);
+  for (int i = 0; i < repeats; i++) {
+    samples[i] = run_ops(&ops, slots) / ops.count;
+  }
+  qsort(samples, repeats, sizeof(double), compare_doubles);
+  printf("%-10s %12zu %12.2f %12.2f\n", scenario->name, ops.count, samples[0],
+         samples[repeats / 2]);
+  free(samples);
+  free(slots);
+  free(ops.ops);
+}
+
+void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options] [scenario...]\n"
+          "  --ops N       Generate about N ops per scenario (default: "
+          "2000000).\n"
+          "  --repeats N   Time each scenario N times (default: 5).\n"
+          "  Scenarios (default: all):",
+          argv0);
+  for (int i = 0; i < NUM_SCENARIOS; i++) {
+    fprintf(stderr, " %s", scenarios[i].name);
+  }
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+  size_t target = 2000000;
+  int repeats = 5;
+  bool selected[NUM_SCENARIOS] = {false};
+  bool any_selected = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+      target = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc) {
+      repeats = atoi(argv[++i]);
+      if (repeats < 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else {
+      int s = 0;
+      while (s < NUM_SCENARIOS && strcmp(scenarios[s].name, argv[i]) != 0) {
+        s++;
+      }
+      if (s == NUM_SCENARIOS) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      selected[s] = any_selected = true;
+    }
+  }
+  printf("%-10s %12s %12s %12s\n", "scenario", "ops", "best ns/op",
+         "median ns/op");
+  for (int s = 0; s < NUM_SCENARIOS; s++) {
+    if (!any_selected || selected[s]) {
+      run_scenario(&scenarios[s], target, repeats);
+    }
+  }
+  return 0;
+}
+
+//
+// Interfaces to get memory pages from OS, the same as main.c without the
+// stats of the challenges.
+//
+
+void *mmap_from_system(size_t size) {
+  assert(size % 4096 == 0);
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(ptr != MAP_FAILED);
+  return ptr;
+}
+
+void *mmap_decommitted_from_system(size_t size, size_t committed_size) {
+  assert(committed_size % 4096 == 0 && committed_size <= size);
+  return mmap_from_system(size);
+}
+
+void munmap_to_system(void *ptr, size_t size) {
+  assert(size % 4096 == 0);
+  assert((uintptr_t)(ptr) % 4096 == 0);
+  int ret = munmap(ptr, size);
+  assert(ret != -1);
+}
+
+void madvise_to_system(void *ptr, size_t size) {
+  assert(size % 4096 == 0);
+  assert((uintptr_t)(ptr) % 4096 == 0);
+  int ret = madvise(ptr, size, MADV_DONTNEED);
+  assert(ret != -1);
+}
+
+void recommit_from_system(void *ptr, size_t size) {
+  assert(size % 4096 == 0);
+  assert((uintptr_t)(ptr) % 4096 == 0);
+}
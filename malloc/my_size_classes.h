@@ -0,0 +1,20 @@
+// Generated by trace/size_class_optimizer.bin. DO NOT EDIT.
+// 13750 allocations, 386 distinct sizes. Expected internal fragmentation: 1.06%
+#ifndef MY_SIZE_CLASSES_H
+#define MY_SIZE_CLASSES_H
+
+#define MY_NUM_SIZE_CLASSES 64
+
+// The largest object size of each size class, in ascending order.
+static const size_t my_size_classes[MY_NUM_SIZE_CLASSES] = {
+    16, 24, 32, 40, 48, 64, 72, 96,
+    128, 168, 216, 264, 288, 312, 336, 352,
+    376, 400, 416, 432, 456, 480, 528, 560,
+    584, 608, 648, 672, 712, 736, 776, 808,
+    832, 872, 912, 952, 976, 1008, 1048, 1088,
+    1160, 1200, 1264, 1312, 1360, 1392, 1440, 1480,
+    1560, 1608, 1672, 1736, 1856, 1912, 2016, 2096,
+    2152, 2312, 2472, 2560, 2848, 3144, 3576, 4000,
+};
+
+#endif  // MY_SIZE_CLASSES_H
@@ -0,0 +1,20 @@
+#ifndef BUCKETS_H_
+#define BUCKETS_H_
+
+#include <stdint.h>
+
+/*
+Sizes and lifetimes are bucketed by powers of two: bucket b holds the values
+in [2^b, 2^(b+1)), and bucket 0 also holds 0. Shared by the tools in this
+directory and malloc/main.c, which reads the buckets of a workload model
+written by workload_generator.bin.
+*/
+#define NUM_BUCKETS 64
+
+static inline int bucket_of(int64_t value) {
+  int b = 0;
+  while (b + 1 < NUM_BUCKETS && (value >> (b + 1)) > 0) b++;
+  return b;
+}
+
+#endif  // BUCKETS_H_
@@ -1,13 +1,27 @@
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 static int trace_fd;
+// Set MALLOC_TRACE_TIME=1 to record the time of each op as a "t <ns>" line.
+static int trace_time;
+// The number of return addresses recorded for each allocation as a
+// "s <n> <pc>..." line. Set MALLOC_TRACE_BACKTRACE=<n> to record up to
+// MAX_BACKTRACE_DEPTH frames by walking frame pointers; only the immediate
+// caller is recorded by default.
+#define MAX_BACKTRACE_DEPTH 16
+static int trace_backtrace_depth = 1;
+// Non-zero while an entry point calls into the original allocator, which may
+// call the other hooked functions (e.g. reallocarray() calls realloc()).
+// Those nested calls are not recorded since the outer one is.
+static __thread int in_original;
 
 void write_uint64_hex(char** wc, uint64_t value) {
   int i;
@@ -36,9 +50,130 @@ void write_string(char** wc, char* s) {
   **wc = 0;
 }
 
-void trace_print_malloc(void* p, size_t size) {
-  char s[2 + (16 + 1) * 2 + 10];
+#define TIME_LINE_SIZE (2 + 16 + 1)
+#define SITE_LINE_SIZE (2 + 2 + (1 + 16) * MAX_BACKTRACE_DEPTH + 1)
+
+// Append a "t <ns>" line if MALLOC_TRACE_TIME=1.
+void write_time(char** wc) {
+  if (!trace_time) return;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  write_string(wc, "t ");
+  write_uint64_hex(wc, (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+  write_string(wc, "\n");
+}
+
+// Return the top (the highest address) of the stack of this thread. The
+// main thread uses the stack pointer at the program entry, and the other
+// threads ask pthread, which may allocate, so that is done once per thread
+// with the hooks disabled.
+extern void* __libc_stack_end;
+static __thread char* stack_top;
+static char* get_stack_top() {
+  if (stack_top) return stack_top;
+  if (gettid() == getpid()) {
+    stack_top = __libc_stack_end;
+    return stack_top;
+  }
+  pthread_attr_t attr;
+  in_original++;
+  if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    void* addr;
+    size_t size;
+    if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+      stack_top = (char*)addr + size;
+    }
+    pthread_attr_destroy(&attr);
+  }
+  in_original--;
+  return stack_top;
+}
+
+// Append the call site of an allocation as a "s <n> <pc>..." line. |frame|
+// is the frame address of the hooked function, so frame[1] is the return
+// address into its caller. The frame pointer chain is only followed while it
+// moves up the stack by a sane amount and stays below the top of the stack,
+// since callers built without frame pointers leave garbage.
+void write_site(char** wc, void** frame) {
+  char* top = get_stack_top();
+  void* pcs[MAX_BACKTRACE_DEPTH];
+  int n = 0;
+  while (n < trace_backtrace_depth && (!top || (char*)(frame + 2) <= top) &&
+         (uint64_t)frame[1] >= 4096) {
+    pcs[n++] = frame[1];
+    if (!top) break;  // The stack of this thread is unknown.
+    void** next = (void**)frame[0];
+    if (next <= frame || (char*)next - (char*)frame > (1 << 20) ||
+        (uint64_t)next % sizeof(void*)) {
+      break;
+    }
+    frame = next;
+  }
+  write_string(wc, "s ");
+  write_uint64_hex(wc, n);
+  for (int i = 0; i < n; i++) {
+    write_string(wc, " ");
+    write_uint64_hex(wc, (uint64_t)pcs[i]);
+  }
+  write_string(wc, "\n");
+}
+
+// Record the executable mappings as "l <begin> <end> <file_offset> <path>"
+// lines so that call sites can be symbolized offline.
+static void trace_print_mappings() {
+  static char buf[1 << 16];
+  int fd = open("/proc/self/maps", O_RDONLY);
+  if (fd == -1) return;
+  size_t len = 0;
+  ssize_t n;
+  while (len < sizeof(buf) - 1 &&
+         (n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+    len += n;
+  }
+  close(fd);
+  buf[len] = 0;
+  // Each line: <begin>-<end> <perms> <offset> <dev> <inode> <path>
+  char* line = buf;
+  while (*line) {
+    char* eol = line;
+    while (*eol && *eol != '\n') eol++;
+    char* fields[6];
+    int num_fields = 0;
+    char* c = line;
+    while (c < eol && num_fields < 6) {
+      while (c < eol && *c == ' ') c++;
+      if (c == eol) break;
+      fields[num_fields++] = c;
+      while (c < eol && *c != ' ') c++;
+    }
+    if (num_fields == 6 && fields[1][2] == 'x' && fields[5][0] == '/') {
+      char* dash = fields[0];
+      while (*dash != '-') dash++;
+      char s[2 + (16 + 1) * 3];
+      char* wc = &s[0];
+      write_string(&wc, "l ");
+      write(trace_fd, s, wc - s);
+      write(trace_fd, fields[0], dash - fields[0]);
+      write(trace_fd, " ", 1);
+      write(trace_fd, dash + 1, fields[1] - 1 - (dash + 1));
+      write(trace_fd, " ", 1);
+      write(trace_fd, fields[2], fields[3] - 1 - fields[2]);
+      write(trace_fd, " ", 1);
+      write(trace_fd, fields[5], eol - fields[5]);
+      write(trace_fd, "\n", 1);
+    }
+    line = *eol ? eol + 1 : eol;
+  }
+}
+
+// The functions below write a record with one write(). The allocations are
+// preceded by their call site, which is found from |frame| (see write_site()).
+
+void trace_print_malloc(void** frame, void* p, size_t size) {
+  char s[SITE_LINE_SIZE + TIME_LINE_SIZE + 2 + (16 + 1) * 2 + 10];
   char* wc = &s[0];
+  write_site(&wc, frame);
+  write_time(&wc);
   write_string(&wc, "a ");
   write_uint64_hex(&wc, (uint64_t)p);
   write_string(&wc, " ");
@@ -48,18 +183,23 @@ void trace_print_malloc(void* p, size_t size) {
 }
 
 void trace_print_free(void* p) {
-  char s[2 + 16 + 1 + 10];
+  char s[TIME_LINE_SIZE + 2 + 16 + 1 + 10];
   char* wc = &s[0];
+  write_time(&wc);
   write_string(&wc, "f ");
   write_uint64_hex(&wc, (uint64_t)p);
   write_string(&wc, "\n");
   write(trace_fd, s, wc - s);
 }
 
-void trace_print_realloc(void* new_p, size_t size, void* old_p) {
-  char s[2 + (16 + 1) * 3 + 10];
+// |op| is "r " for realloc() and "R " for reallocarray().
+void trace_print_realloc(void** frame, char* op, void* new_p, size_t size,
+                         void* old_p) {
+  char s[SITE_LINE_SIZE + TIME_LINE_SIZE + 2 + (16 + 1) * 3 + 10];
   char* wc = &s[0];
-  write_string(&wc, "r ");
+  write_site(&wc, frame);
+  write_time(&wc);
+  write_string(&wc, op);
   write_uint64_hex(&wc, (uint64_t)new_p);
   write_string(&wc, " ");
   write_uint64_hex(&wc, size);
@@ -69,6 +209,36 @@ void trace_print_realloc(void* new_p, size_t size, void* old_p) {
   write(trace_fd, s, wc - s);
 }
 
+void trace_print_aligned(void** frame, char* entry_point, void* p,
+                         size_t size, size_t alignment) {
+  char s[SITE_LINE_SIZE + TIME_LINE_SIZE + 2 + (16 + 1) * 3 + 1 + 16 + 10];
+  char* wc = &s[0];
+  write_site(&wc, frame);
+  write_time(&wc);
+  write_string(&wc, "A ");
+  write_uint64_hex(&wc, (uint64_t)p);
+  write_string(&wc, " ");
+  write_uint64_hex(&wc, size);
+  write_string(&wc, " ");
+  write_uint64_hex(&wc, alignment);
+  write_string(&wc, " ");
+  write_string(&wc, entry_point);
+  write_string(&wc, "\n");
+  write(trace_fd, s, wc - s);
+}
+
+void trace_print_usable_size(void* p, size_t usable_size) {
+  char s[TIME_LINE_SIZE + 2 + (16 + 1) * 2 + 10];
+  char* wc = &s[0];
+  write_time(&wc);
+  write_string(&wc, "U ");
+  write_uint64_hex(&wc, (uint64_t)p);
+  write_string(&wc, " ");
+  write_uint64_hex(&wc, usable_size);
+  write_string(&wc, "\n");
+  write(trace_fd, s, wc - s);
+}
+
 static void init_trace_fp() {
   if (trace_fd) {
     return;
@@ -83,6 +253,17 @@ static void init_trace_fp() {
     fprintf(stderr, "init_trace_fp() failed.\n");
     exit(EXIT_FAILURE);
   }
+  const char* time_env = getenv("MALLOC_TRACE_TIME");
+  trace_time = time_env && time_env[0] == '1';
+  const char* backtrace_env = getenv("MALLOC_TRACE_BACKTRACE");
+  if (backtrace_env) {
+    trace_backtrace_depth = atoi(backtrace_env);
+    if (trace_backtrace_depth < 1) trace_backtrace_depth = 1;
+    if (trace_backtrace_depth > MAX_BACKTRACE_DEPTH) {
+      trace_backtrace_depth = MAX_BACKTRACE_DEPTH;
+    }
+  }
+  trace_print_mappings();
 }
 
 void* malloc(size_t size) {
@@ -92,7 +273,8 @@ void* malloc(size_t size) {
     original_malloc = dlsym(RTLD_NEXT, "malloc");
   }
   void* p = original_malloc(size);
-  trace_print_malloc(p, size);
+  if (in_original) return p;
+  trace_print_malloc(__builtin_frame_address(0), p, size);
   return p;
 }
 
@@ -111,13 +293,14 @@ void* calloc(size_t n, size_t elem_size) {
       }
       void* p = &tmp_buffer[tmp_buffer_used];
       tmp_buffer_used += n * elem_size;
-      trace_print_malloc(p, elem_size * n);
+      trace_print_malloc(__builtin_frame_address(0), p, elem_size * n);
       return p;
     }
     original_calloc = dlsym(RTLD_NEXT, "calloc");
   }
   void* p = original_calloc(n, elem_size);
-  trace_print_malloc(p, elem_size * n);
+  if (in_original) return p;
+  trace_print_malloc(__builtin_frame_address(0), p, elem_size * n);
   return p;
 }
 
@@ -134,6 +317,7 @@ void free(void* p) {
   } else {
     original_free(p);
   }
+  if (in_original) return;
   trace_print_free(p);
 }
 
@@ -144,11 +328,131 @@ void* realloc(void* p, size_t size) {
     original_realloc = dlsym(RTLD_NEXT, "realloc");
   }
   void* new_p = original_realloc(p, size);
-  trace_print_realloc(new_p, size, p);
+  if (in_original) return new_p;
+  trace_print_realloc(__builtin_frame_address(0), "r ", new_p, size, p);
   return new_p;
 }
 
 void* reallocarray(void* p, size_t n, size_t elem_size) {
-  fprintf(stderr, "reallocarray called\n");
-  exit(EXIT_FAILURE);
+  static void* (*original_reallocarray)(void*, size_t, size_t);
+  if (!original_reallocarray) {
+    init_trace_fp();
+    original_reallocarray = dlsym(RTLD_NEXT, "reallocarray");
+  }
+  in_original++;
+  void* new_p = original_reallocarray(p, n, elem_size);
+  in_original--;
+  if (new_p && !in_original) {
+    // On failure (including an overflow of n * elem_size) |p| is untouched.
+    trace_print_realloc(__builtin_frame_address(0), "R ", new_p, n * elem_size,
+                        p);
+  }
+  return new_p;
+}
+
+//
+// Aligned allocations are recorded as
+// "A <addr> <size> <alignment> <entry_point>", where <entry_point> is the name
+// of the function called (posix_memalign, aligned_alloc, memalign, valloc or
+// pvalloc).
+//
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+  static int (*original_posix_memalign)(void**, size_t, size_t);
+  if (!original_posix_memalign) {
+    init_trace_fp();
+    original_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+  }
+  in_original++;
+  int ret = original_posix_memalign(memptr, alignment, size);
+  in_original--;
+  if (ret == 0 && !in_original) {
+    trace_print_aligned(__builtin_frame_address(0), "posix_memalign", *memptr,
+                        size, alignment);
+  }
+  return ret;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  static void* (*original_aligned_alloc)(size_t, size_t);
+  if (!original_aligned_alloc) {
+    init_trace_fp();
+    original_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+  }
+  in_original++;
+  void* p = original_aligned_alloc(alignment, size);
+  in_original--;
+  if (p && !in_original) {
+    trace_print_aligned(__builtin_frame_address(0), "aligned_alloc", p, size,
+                        alignment);
+  }
+  return p;
+}
+
+void* memalign(size_t alignment, size_t size) {
+  static void* (*original_memalign)(size_t, size_t);
+  if (!original_memalign) {
+    init_trace_fp();
+    original_memalign = dlsym(RTLD_NEXT, "memalign");
+  }
+  in_original++;
+  void* p = original_memalign(alignment, size);
+  in_original--;
+  if (p && !in_original) {
+    trace_print_aligned(__builtin_frame_address(0), "memalign", p, size,
+                        alignment);
+  }
+  return p;
+}
+
+void* valloc(size_t size) {
+  static void* (*original_valloc)(size_t);
+  if (!original_valloc) {
+    init_trace_fp();
+    original_valloc = dlsym(RTLD_NEXT, "valloc");
+  }
+  in_original++;
+  void* p = original_valloc(size);
+  in_original--;
+  if (p && !in_original) {
+    trace_print_aligned(__builtin_frame_address(0), "valloc", p, size,
+                        sysconf(_SC_PAGESIZE));
+  }
+  return p;
+}
+
+void* pvalloc(size_t size) {
+  static void* (*original_pvalloc)(size_t);
+  if (!original_pvalloc) {
+    init_trace_fp();
+    original_pvalloc = dlsym(RTLD_NEXT, "pvalloc");
+  }
+  in_original++;
+  void* p = original_pvalloc(size);
+  in_original--;
+  if (p && !in_original) {
+    // pvalloc() rounds the size up to the page size.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    trace_print_aligned(__builtin_frame_address(0), "pvalloc", p,
+                        (size + page_size - 1) / page_size * page_size,
+                        page_size);
+  }
+  return p;
+}
+
+// Recorded as "U <addr> <usable_size>". This does not change the heap, but
+// tells how much of the allocator's slack the program may be relying on.
+size_t malloc_usable_size(void* p) {
+  static size_t (*original_malloc_usable_size)(void*);
+  if (!original_malloc_usable_size) {
+    init_trace_fp();
+    original_malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+  }
+  in_original++;
+  size_t usable_size = original_malloc_usable_size(p);
+  in_original--;
+  if (p && !in_original) {
+    trace_print_usable_size(p, usable_size);
+  }
+  return usable_size;
 }
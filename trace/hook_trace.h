@@ -0,0 +1,87 @@
+#ifndef HOOK_TRACE_H_
+#define HOOK_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+Reads the allocations and frees of a malloc trace from stdin, for the tools
+which only need those.
+
+trace format (hook.c, numbers in hex):
+  a <addr> <size>
+  f <addr>
+  r <new_addr> <size> <old_addr>  (R for reallocarray)
+  A <addr> <size> <alignment> <entry_point>  (posix_memalign, valloc, ...)
+  (t, s, l and U lines are skipped)
+trace format with -d (malloc challenge / trace2timeline, in decimal):
+  a <addr> <size>  (A for aligned allocations)
+  f <addr> <size>
+  (other ops are skipped)
+
+Every allocation and every free is one op. A realloc of an object is a free
+of the old object and an allocation of the new one, i.e. two ops, the same
+as the harness counts ops when it replays a workload model.
+*/
+
+// Call |on_alloc(addr, size)| for each allocation and |on_free(addr)| for
+// each free in the trace on stdin, in the order of the trace.
+template <typename OnAlloc, typename OnFree>
+void read_trace(bool decimal, OnAlloc on_alloc, OnFree on_free) {
+  char op;
+  int64_t addr, size;
+  int64_t records = 0;
+  if (decimal) {
+    while (scanf(" %c %ld %ld", &op, &addr, &size) == 3) {
+      if (op == 'a' || op == 'A') {
+        on_alloc(addr, size);
+      } else if (op == 'f') {
+        on_free(addr);
+      }
+    }
+    return;
+  }
+  while (scanf(" %c %lX", &op, (uint64_t *)&addr) == 2) {
+    records++;
+    if (op == 'a') {
+      if (scanf(" %lX", (uint64_t *)&size) != 1) {
+        fprintf(stderr, "Failed to read size for alloc\n");
+        exit(EXIT_FAILURE);
+      }
+      on_alloc(addr, size);
+    } else if (op == 'r' || op == 'R') {
+      int64_t old_addr;
+      if (scanf(" %lX %lX", (uint64_t *)&size, (uint64_t *)&old_addr) != 2) {
+        fprintf(stderr, "Failed to read size and old_addr for realloc\n");
+        exit(EXIT_FAILURE);
+      }
+      if (old_addr) {
+        on_free(old_addr);
+      }
+      on_alloc(addr, size);
+    } else if (op == 'A') {
+      int64_t alignment;
+      if (scanf(" %lX %lX %*s", (uint64_t *)&size, (uint64_t *)&alignment) !=
+          2) {
+        fprintf(stderr,
+                "Failed to read size, alignment and entry point for aligned "
+                "alloc\n");
+        exit(EXIT_FAILURE);
+      }
+      on_alloc(addr, size);
+    } else if (op == 'f') {
+      on_free(addr);
+    } else if (op == 't') {
+      continue;  // A timestamp (MALLOC_TRACE_TIME=1).
+    } else if (op == 's' || op == 'l' || op == 'U') {
+      // A call site, a mapping or a malloc_usable_size() query.
+      if (scanf("%*[^\n]") < 0) break;
+    } else {
+      fprintf(stderr, "Unknown op: %c at record %ld\n", op, records);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+#endif  // HOOK_TRACE_H_
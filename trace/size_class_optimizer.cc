@@ -0,0 +1,188 @@
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "hook_trace.h"
+
+/*
+Reads a malloc trace from stdin and computes size class boundaries which
+minimize the expected internal fragmentation, then writes them to stdout as a
+C header which malloc/malloc.c includes as its class table.
+
+Each allocation is weighted by its lifetime (the number of ops until it is
+freed, or until the end of the trace if it is never freed), so that sizes
+which occupy memory for a long time matter more than short-lived ones.
+
+input trace format: hook.c, or the malloc challenge with -d (see
+hook_trace.h)
+*/
+
+struct Allocation {
+  int64_t size;
+  int64_t begin_op;
+};
+
+std::unordered_map<int64_t, Allocation> live_allocations;
+// Rounded size -> sum of lifetimes of the allocations with that size.
+std::map<int64_t, double> weights;
+int64_t alignment = 8;
+int64_t max_size = std::numeric_limits<int64_t>::max();
+int64_t num_allocations = 0;
+int64_t op_count = 0;
+
+void add_weight(int64_t size, int64_t lifetime) {
+  size = (size + alignment - 1) / alignment * alignment;
+  if (size == 0 || size > max_size) {
+    return;
+  }
+  // Count at least one op so that objects freed right away still have a say.
+  weights[size] += std::max<int64_t>(lifetime, 1);
+}
+
+void record_alloc(int64_t addr, int64_t size) {
+  live_allocations[addr] = {size, op_count++};
+  num_allocations++;
+}
+
+void record_free(int64_t addr) {
+  const auto &it = live_allocations.find(addr);
+  if (it != live_allocations.end()) {
+    add_weight(it->second.size, op_count - it->second.begin_op);
+    live_allocations.erase(it);
+  }
+  op_count++;
+}
+
+// Splits the sorted sizes into |num_classes| contiguous groups. Every size is
+// rounded up to the largest size of its group, so the cost of a group [i, j]
+// is sum_k weight[k] * (size[j] - size[k]). Returns the inclusive upper bound
+// of each class and stores the total cost to |*cost|.
+std::vector<int64_t> optimize(const std::vector<int64_t> &sizes,
+                              const std::vector<double> &w, int num_classes,
+                              double *cost) {
+  const int n = sizes.size();
+  num_classes = std::min(num_classes, n);
+  // Prefix sums of weight and weight * size, so a group costs O(1) to price.
+  std::vector<double> sum_w(n + 1, 0), sum_wx(n + 1, 0);
+  for (int i = 0; i < n; i++) {
+    sum_w[i + 1] = sum_w[i] + w[i];
+    sum_wx[i + 1] = sum_wx[i] + w[i] * sizes[i];
+  }
+  auto group_cost = [&](int i, int j) {
+    return sizes[j] * (sum_w[j + 1] - sum_w[i]) - (sum_wx[j + 1] - sum_wx[i]);
+  };
+  const double inf = std::numeric_limits<double>::infinity();
+  // best[c][j]: the min cost of covering sizes[0..j] with c + 1 classes.
+  // split[c][j]: the first index of the last class of that solution.
+  std::vector<std::vector<double>> best(num_classes,
+                                        std::vector<double>(n, inf));
+  std::vector<std::vector<int>> split(num_classes, std::vector<int>(n, 0));
+  for (int j = 0; j < n; j++) {
+    best[0][j] = group_cost(0, j);
+  }
+  for (int c = 1; c < num_classes; c++) {
+    for (int j = c; j < n; j++) {
+      for (int i = c; i <= j; i++) {
+        double candidate = best[c - 1][i - 1] + group_cost(i, j);
+        if (candidate < best[c][j]) {
+          best[c][j] = candidate;
+          split[c][j] = i;
+        }
+      }
+    }
+  }
+  std::vector<int64_t> classes;
+  int j = n - 1;
+  for (int c = num_classes - 1; c >= 0; c--) {
+    classes.push_back(sizes[j]);
+    j = split[c][j] - 1;
+  }
+  std::reverse(classes.begin(), classes.end());
+  *cost = best[num_classes - 1][n - 1];
+  return classes;
+}
+
+void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-n num_classes] [-a alignment] [-m max_size] [-d] "
+          "< trace > my_size_classes.h\n"
+          "  -n  The number of size classes (default: 16)\n"
+          "  -a  Sizes are rounded up to a multiple of this (default: 8)\n"
+          "  -m  Ignore allocations larger than this\n"
+          "  -d  Read the decimal trace format of the malloc challenge\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  int num_classes = 16;
+  bool decimal = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:a:m:d")) != -1) {
+    if (opt == 'n') {
+      num_classes = atoi(optarg);
+    } else if (opt == 'a') {
+      alignment = atol(optarg);
+    } else if (opt == 'm') {
+      max_size = atol(optarg);
+    } else if (opt == 'd') {
+      decimal = true;
+    } else {
+      print_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (num_classes < 1 || alignment < 1) {
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  read_trace(decimal, record_alloc, record_free);
+  // Objects which are never freed live until the end of the trace.
+  for (const auto &it : live_allocations) {
+    add_weight(it.second.size, op_count - it.second.begin_op);
+  }
+  if (weights.empty()) {
+    fprintf(stderr, "No allocations found in the trace\n");
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<int64_t> sizes;
+  std::vector<double> w;
+  double total_weighted_size = 0;
+  for (const auto &it : weights) {
+    sizes.push_back(it.first);
+    w.push_back(it.second);
+    total_weighted_size += it.first * it.second;
+  }
+  double cost;
+  std::vector<int64_t> classes = optimize(sizes, w, num_classes, &cost);
+  double fragmentation = 100.0 * cost / (total_weighted_size + cost);
+
+  fprintf(stderr, "allocations: %ld\n", num_allocations);
+  fprintf(stderr, "distinct sizes: %zu\n", sizes.size());
+  fprintf(stderr, "size classes: %zu\n", classes.size());
+  fprintf(stderr, "expected internal fragmentation: %.2f%%\n", fragmentation);
+
+  printf("// Generated by trace/size_class_optimizer.bin. DO NOT EDIT.\n");
+  printf("// %ld allocations, %zu distinct sizes. ", num_allocations,
+         sizes.size());
+  printf("Expected internal fragmentation: %.2f%%\n", fragmentation);
+  printf("#ifndef MY_SIZE_CLASSES_H\n");
+  printf("#define MY_SIZE_CLASSES_H\n\n");
+  printf("#define MY_NUM_SIZE_CLASSES %zu\n\n", classes.size());
+  printf("// The largest object size of each size class, in ascending order.\n");
+  printf("static const size_t my_size_classes[MY_NUM_SIZE_CLASSES] = {\n");
+  for (size_t i = 0; i < classes.size(); i++) {
+    printf("%s%ld,%s", i % 8 == 0 ? "    " : " ", classes[i],
+           i % 8 == 7 || i + 1 == classes.size() ? "\n" : "");
+  }
+  printf("};\n\n");
+  printf("#endif  // MY_SIZE_CLASSES_H\n");
+  return 0;
+}
@@ -1,10 +1,85 @@
+#include <elf.h>
+#include <getopt.h>
 #include <stdio.h>
+#include <string.h>
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <limits>
+#include <map>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
-std::unordered_map<int64_t, int64_t> alloc_sizes;
+#include "buckets.h"
+// Objects freed within this many ops are counted as short-lived.
+constexpr int64_t kShortLivedOps = 1024;
+
+// The number of call sites printed, ordered by the allocated bytes.
+constexpr size_t kNumTopSites = 20;
+
+// The address axis of the heatmap only has the blocks of this size which are
+// touched by the trace, so that the gaps between mappings take no space.
+constexpr int64_t kHeatmapBlockSize = 64 * 1024;
+// The cells of a zoom level are stored in tiles of this many cells per side.
+constexpr int kHeatmapTileSize = 256;
+
+struct Allocation {
+  int64_t size;
+  int64_t begin_op;
+  int64_t begin_time;  // -1 if the trace has no timestamps.
+  size_t record;       // Index in |lifetime_records|.
+};
+
+// Per call site statistics. A call site is the backtrace recorded by the
+// preceding 's' op (just the caller of malloc by default).
+struct Site {
+  std::vector<uint64_t> pcs;
+  int64_t count = 0;
+  int64_t bytes = 0;
+  int64_t freed_count = 0;
+  int64_t lifetime_ops_sum = 0;  // of the freed objects.
+  int64_t peak_bytes = 0;        // live bytes at the op of the peak.
+};
+
+// Lifetime of every allocation, to compute the contribution of each site to
+// the peak once the op of the peak is known.
+struct LifetimeRecord {
+  size_t site;
+  int64_t size;
+  int64_t begin_op;
+  int64_t end_op;  // -1 if never freed.
+};
+
+// An executable mapping recorded by an 'l' op.
+struct Mapping {
+  uint64_t begin;
+  uint64_t end;
+  uint64_t file_offset;
+  std::string path;
+};
+
+std::vector<Site> sites;
+std::map<std::vector<uint64_t>, size_t> site_ids;
+std::vector<uint64_t> current_site_pcs;
+std::vector<LifetimeRecord> lifetime_records;
+std::vector<Mapping> mappings;
+int64_t peak_op = 0;
+
+// Counts of the entry points other than malloc / calloc / realloc / free.
+int64_t reallocarray_count = 0;
+// Alignment -> (count, bytes) of aligned allocations.
+std::map<int64_t, std::pair<int64_t, int64_t>> aligned_allocs;
+// Entry point (posix_memalign, aligned_alloc, ...) -> (count, bytes) of
+// aligned allocations.
+std::map<std::string, std::pair<int64_t, int64_t>> aligned_entry_points;
+int64_t usable_size_queries = 0;
+// Sum of (usable size - requested size) over the queried live objects.
+int64_t usable_size_slack = 0;
+
+std::unordered_map<int64_t, Allocation> alloc_sizes;
 int64_t peak_size = 0;
 int64_t resident_size = 0;
 int64_t allocation_size_accumlated = 0;
@@ -12,26 +87,66 @@ int64_t free_size_accumlated = 0;
 FILE *trace_fp;
 int64_t range_begin = std::numeric_limits<int64_t>::max();
 int64_t range_end = std::numeric_limits<int64_t>::min();
+int64_t current_op = 0;
+int64_t current_time = -1;  // in ns, updated by 't' ops.
+
+int64_t lifetime_op_count[NUM_BUCKETS];
+int64_t lifetime_op_bytes[NUM_BUCKETS];
+int64_t lifetime_time_count[NUM_BUCKETS];
+int64_t lifetime_time_bytes[NUM_BUCKETS];
+// Bytes freed, indexed by the size bucket and the lifetime bucket (in ops).
+int64_t size_lifetime_bytes[NUM_BUCKETS][NUM_BUCKETS];
+int64_t short_lived_bytes = 0;
+
+// An op written to trace.txt, kept to build the heatmap (-t).
+struct HeatmapEvent {
+  int64_t addr;
+  int64_t size;
+  char op;
+};
+
+bool heatmap_enabled = false;
+std::vector<HeatmapEvent> heatmap_events;
 
 /*
 output trace format:
-a <begin_addr> <end_addr>
-f <begin_addr> <end_addr>
-r <begin_addr> <end_addr>
+a <begin_addr> <size>
+A <begin_addr> <size>  (aligned allocation)
+f <begin_addr> <size>
+m / u / d / c <begin_addr> <size>  (only with -d, copied from the input)
 */
 void trace_op(char op, int64_t addr, int64_t size) {
   // Trace addr < 0x1'0000'0000LL ops only to ease visualization
   fprintf(trace_fp, "%c %ld %ld\n", op, addr, size);
   range_begin = std::min(range_begin, addr);
   range_end = std::max(range_end, addr + size);
+  if (heatmap_enabled) {
+    heatmap_events.push_back({addr, size, op});
+  }
 }
 
-void record_alloc(int64_t addr, int64_t size) {
-  alloc_sizes.insert({addr, size});
+// |op| is 'A' for aligned allocations and 'a' for the others.
+void record_alloc(int64_t addr, int64_t size, char op = 'a') {
+  auto site_it = site_ids.find(current_site_pcs);
+  if (site_it == site_ids.end()) {
+    site_it = site_ids.insert({current_site_pcs, sites.size()}).first;
+    sites.push_back(Site());
+    sites.back().pcs = current_site_pcs;
+  }
+  Site &site = sites[site_it->second];
+  site.count++;
+  site.bytes += size;
+  current_site_pcs.clear();
+  alloc_sizes.insert(
+      {addr, {size, current_op, current_time, lifetime_records.size()}});
+  lifetime_records.push_back({site_it->second, size, current_op, -1});
   resident_size += size;
   allocation_size_accumlated += size;
-  peak_size = std::max(peak_size, resident_size);
-  trace_op('a', addr, size);
+  if (resident_size > peak_size) {
+    peak_size = resident_size;
+    peak_op = current_op;
+  }
+  trace_op(op, addr, size);
 }
 
 
@@ -41,7 +156,24 @@ void record_free(int64_t addr) {
     printf("Addr 0x%lX is being freed but not allocated\n", addr);
     return;
   }
-  const int64_t size = (*it).second;
+  const int64_t size = (*it).second.size;
+  const int64_t lifetime_ops = current_op - (*it).second.begin_op;
+  const int b = bucket_of(lifetime_ops);
+  lifetime_op_count[b]++;
+  lifetime_op_bytes[b] += size;
+  size_lifetime_bytes[bucket_of(size)][b] += size;
+  if (lifetime_ops < kShortLivedOps) {
+    short_lived_bytes += size;
+  }
+  if ((*it).second.begin_time >= 0 && current_time >= 0) {
+    const int tb = bucket_of(current_time - (*it).second.begin_time);
+    lifetime_time_count[tb]++;
+    lifetime_time_bytes[tb] += size;
+  }
+  LifetimeRecord &record = lifetime_records[(*it).second.record];
+  record.end_op = current_op;
+  sites[record.site].freed_count++;
+  sites[record.site].lifetime_ops_sum += lifetime_ops;
   alloc_sizes.erase(it);
 
   resident_size -= size;
@@ -49,37 +181,585 @@ void record_free(int64_t addr) {
   trace_op('f', addr, size);
 }
 
-int main() {
+void print_lifetime_histogram(const char *unit, int64_t *counts,
+                              int64_t *bytes) {
+  fprintf(stderr, "%-24s %12s %16s\n", unit, "count", "bytes");
+  for (int b = 0; b < NUM_BUCKETS; b++) {
+    if (!counts[b]) continue;
+    char label[32];
+    snprintf(label, sizeof(label), "[2^%d, 2^%d)", b, b + 1);
+    fprintf(stderr, "%-24s %12ld %16ld\n", label, counts[b], bytes[b]);
+  }
+}
+
+// Print how long objects live and how that relates to their sizes, to stderr.
+// Objects which are never freed are counted as immortal.
+void print_lifetime_stats() {
+  int64_t immortal_count = alloc_sizes.size();
+  int64_t immortal_bytes = 0;
+  for (const auto &it : alloc_sizes) {
+    immortal_bytes += it.second.size;
+  }
+  fprintf(stderr, "\n");
+  print_lifetime_histogram("lifetime [ops]", lifetime_op_count,
+                           lifetime_op_bytes);
+  fprintf(stderr, "%-24s %12ld %16ld\n", "immortal", immortal_count,
+          immortal_bytes);
+  int64_t timed = 0;
+  for (int b = 0; b < NUM_BUCKETS; b++) timed += lifetime_time_count[b];
+  if (timed) {
+    fprintf(stderr, "\n");
+    print_lifetime_histogram("lifetime [ns]", lifetime_time_count,
+                             lifetime_time_bytes);
+  }
+
+  // Size x lifetime joint distribution of the freed bytes.
+  int min_lb = NUM_BUCKETS, max_lb = -1;
+  for (int sb = 0; sb < NUM_BUCKETS; sb++) {
+    for (int lb = 0; lb < NUM_BUCKETS; lb++) {
+      if (!size_lifetime_bytes[sb][lb]) continue;
+      min_lb = std::min(min_lb, lb);
+      max_lb = std::max(max_lb, lb);
+    }
+  }
+  if (max_lb >= 0) {
+    fprintf(stderr, "\nfreed bytes by size (rows) x lifetime [ops] (cols)\n");
+    fprintf(stderr, "%-10s", "size");
+    char label[32];
+    for (int lb = min_lb; lb <= max_lb; lb++) {
+      snprintf(label, sizeof(label), "<2^%d", lb + 1);
+      fprintf(stderr, " %11s", label);
+    }
+    fprintf(stderr, "\n");
+    for (int sb = 0; sb < NUM_BUCKETS; sb++) {
+      int64_t row = 0;
+      for (int lb = min_lb; lb <= max_lb; lb++) row += size_lifetime_bytes[sb][lb];
+      if (!row) continue;
+      snprintf(label, sizeof(label), "<2^%d", sb + 1);
+      fprintf(stderr, "%-10s", label);
+      for (int lb = min_lb; lb <= max_lb; lb++) {
+        fprintf(stderr, " %11ld", size_lifetime_bytes[sb][lb]);
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+
+  const double total = allocation_size_accumlated;
+  if (total > 0) {
+    fprintf(stderr, "\nshort-lived bytes (< %ld ops): %.1f%%\n",
+            kShortLivedOps, 100.0 * short_lived_bytes / total);
+    fprintf(stderr, "long-lived bytes: %.1f%%\n",
+            100.0 * (total - short_lived_bytes - immortal_bytes) / total);
+    fprintf(stderr, "immortal bytes: %.1f%%\n",
+            100.0 * immortal_bytes / total);
+  }
+}
+
+// Symbols of an ELF file, to symbolize call sites offline.
+struct SymbolTable {
+  struct Symbol {
+    uint64_t addr;
+    uint64_t size;
+    std::string name;
+  };
+  // (p_offset, p_vaddr, p_filesz) of each PT_LOAD segment.
+  std::vector<Elf64_Phdr> segments;
+  std::vector<Symbol> symbols;  // Sorted by addr.
+};
+
+std::map<std::string, SymbolTable> symbol_tables;
+
+// Load .symtab (or .dynsym if the file is stripped) of the ELF file at
+// |path|. Returns an empty table if the file can not be read.
+const SymbolTable &load_symbol_table(const std::string &path) {
+  auto it = symbol_tables.find(path);
+  if (it != symbol_tables.end()) return it->second;
+  SymbolTable &table = symbol_tables[path];
+  std::ifstream file(path, std::ios::binary);
+  std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+  if (data.size() < sizeof(Elf64_Ehdr) ||
+      memcmp(data.data(), ELFMAG, SELFMAG) != 0 ||
+      data[EI_CLASS] != ELFCLASS64) {
+    return table;
+  }
+  const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)data.data();
+  if (ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf64_Phdr) > data.size() ||
+      ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr) > data.size()) {
+    return table;
+  }
+  const Elf64_Phdr *phdrs = (const Elf64_Phdr *)(data.data() + ehdr->e_phoff);
+  for (int i = 0; i < ehdr->e_phnum; i++) {
+    if (phdrs[i].p_type == PT_LOAD) table.segments.push_back(phdrs[i]);
+  }
+  const Elf64_Shdr *shdrs = (const Elf64_Shdr *)(data.data() + ehdr->e_shoff);
+  for (uint32_t type : {SHT_SYMTAB, SHT_DYNSYM}) {
+    for (int i = 0; i < ehdr->e_shnum; i++) {
+      const Elf64_Shdr &shdr = shdrs[i];
+      if (shdr.sh_type != type || shdr.sh_link >= ehdr->e_shnum) continue;
+      const Elf64_Shdr &strtab = shdrs[shdr.sh_link];
+      if (shdr.sh_offset + shdr.sh_size > data.size() ||
+          strtab.sh_offset + strtab.sh_size > data.size()) {
+        continue;
+      }
+      const Elf64_Sym *syms = (const Elf64_Sym *)(data.data() + shdr.sh_offset);
+      for (size_t j = 0; j < shdr.sh_size / sizeof(Elf64_Sym); j++) {
+        if (ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC || !syms[j].st_value ||
+            syms[j].st_name >= strtab.sh_size) {
+          continue;
+        }
+        const char *name = data.data() + strtab.sh_offset + syms[j].st_name;
+        table.symbols.push_back({syms[j].st_value, syms[j].st_size,
+                                 std::string(name, strnlen(name,
+                                     strtab.sh_size - syms[j].st_name))});
+      }
+    }
+    if (!table.symbols.empty()) break;
+  }
+  std::sort(table.symbols.begin(), table.symbols.end(),
+            [](const SymbolTable::Symbol &a, const SymbolTable::Symbol &b) {
+              return a.addr < b.addr;
+            });
+  return table;
+}
+
+// Return "function+offset (file)" for a runtime address, or the address in
+// hex if it can not be resolved with the recorded mappings.
+std::string symbolize(uint64_t pc) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "0x%lx", pc);
+  for (const Mapping &m : mappings) {
+    if (pc < m.begin || m.end <= pc) continue;
+    const std::string file = m.path.substr(m.path.rfind('/') + 1);
+    // A return address points right after the call, so look up pc - 1.
+    const uint64_t offset = pc - 1 - m.begin + m.file_offset;
+    const SymbolTable &table = load_symbol_table(m.path);
+    for (const Elf64_Phdr &seg : table.segments) {
+      if (offset < seg.p_offset || seg.p_offset + seg.p_filesz <= offset) {
+        continue;
+      }
+      const uint64_t vaddr = offset - seg.p_offset + seg.p_vaddr;
+      auto it = std::upper_bound(
+          table.symbols.begin(), table.symbols.end(), vaddr,
+          [](uint64_t v, const SymbolTable::Symbol &s) { return v < s.addr; });
+      if (it != table.symbols.begin()) {
+        --it;
+        if (!it->size || vaddr < it->addr + it->size) {
+          snprintf(buf, sizeof(buf), "+0x%lx", vaddr + 1 - it->addr);
+          return it->name + buf + " (" + file + ")";
+        }
+      }
+      break;
+    }
+    snprintf(buf, sizeof(buf), "0x%lx", offset + 1);
+    return file + "+" + buf;
+  }
+  return buf;
+}
+
+// Print the stats of aligned allocations, reallocarray() and
+// malloc_usable_size() to stderr.
+void print_entry_point_stats() {
+  if (aligned_allocs.empty() && !reallocarray_count && !usable_size_queries) {
+    return;
+  }
+  fprintf(stderr, "\n");
+  if (!aligned_allocs.empty()) {
+    fprintf(stderr, "%-24s %12s %16s\n", "alignment", "count", "bytes");
+    for (const auto &it : aligned_allocs) {
+      fprintf(stderr, "%-24ld %12ld %16ld\n", it.first, it.second.first,
+              it.second.second);
+    }
+    fprintf(stderr, "%-24s %12s %16s\n", "aligned entry point", "count",
+            "bytes");
+    for (const auto &it : aligned_entry_points) {
+      fprintf(stderr, "%-24s %12ld %16ld\n", it.first.c_str(),
+              it.second.first, it.second.second);
+    }
+  }
+  fprintf(stderr, "reallocarray calls: %ld\n", reallocarray_count);
+  fprintf(stderr, "malloc_usable_size calls: %ld (slack: %ld bytes)\n",
+          usable_size_queries, usable_size_slack);
+}
+
+// Print the call sites which allocated the most bytes, to stderr.
+void print_site_stats() {
+  if (sites.size() <= 1 && (sites.empty() || sites[0].pcs.empty())) {
+    return;  // The trace has no call sites.
+  }
+  for (const LifetimeRecord &r : lifetime_records) {
+    if (r.begin_op <= peak_op && (r.end_op == -1 || r.end_op > peak_op)) {
+      sites[r.site].peak_bytes += r.size;
+    }
+  }
+  std::vector<size_t> order(sites.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [](size_t a, size_t b) {
+    return sites[a].bytes > sites[b].bytes;
+  });
+  fprintf(stderr, "\ncall sites: %zu (top %zu by bytes)\n", sites.size(),
+          std::min(kNumTopSites, sites.size()));
+  fprintf(stderr, "%10s %14s %14s %14s  %s\n", "count", "bytes",
+          "mean lifetime", "bytes at peak", "site");
+  for (size_t i = 0; i < order.size() && i < kNumTopSites; i++) {
+    const Site &site = sites[order[i]];
+    char lifetime[32] = "-";
+    if (site.freed_count) {
+      snprintf(lifetime, sizeof(lifetime), "%.1f",
+               (double)site.lifetime_ops_sum / site.freed_count);
+    }
+    fprintf(stderr, "%10ld %14ld %14s %14ld  %s\n", site.count, site.bytes,
+            lifetime, site.peak_bytes,
+            site.pcs.empty() ? "(unknown)" : symbolize(site.pcs[0]).c_str());
+    for (size_t j = 1; j < site.pcs.size(); j++) {
+      fprintf(stderr, "%56s  <- %s\n", "", symbolize(site.pcs[j]).c_str());
+    }
+  }
+}
+
+/*
+Heatmap tiles (-t <file>): how much of each address range is mapped and
+allocated over time, at several zoom levels, so that the visualizer can draw
+traces which are too large to replay op by op.
+
+The time axis is the index of the ops in trace.txt. The address axis is the
+concatenation of the kHeatmapBlockSize blocks touched by the trace. A cell
+holds the fraction of its bytes which are mapped (resp. allocated), averaged
+over its ops and quantized to 0-255.
+
+file format (little endian):
+  HeatmapHeader
+  HeatmapLevel[num_levels]  (zoom level 0 first)
+  uint64_t block_addrs[num_blocks]  (the address of each block, ascending)
+  the cells of each level at HeatmapLevel::offset
+Zoom level z has kHeatmapTileSize << z cells per side, in (cells / tile)^2
+tiles ordered by (address tile, time tile). A tile is the mapped plane and then
+the allocated plane, each kHeatmapTileSize^2 bytes ordered by (address, time).
+The finest level is the last one.
+*/
+struct HeatmapHeader {
+  char magic[8];  // "MHEATMAP"
+  uint32_t version;
+  uint32_t num_levels;
+  uint32_t tile_size;
+  uint32_t reserved;
+  uint64_t num_ops;
+  uint64_t block_size;
+  uint64_t num_blocks;
+  uint64_t cell_ops;    // ops per cell of the finest level
+  uint64_t cell_bytes;  // bytes per cell of the finest level
+};
+
+struct HeatmapLevel {
+  uint32_t time_cells;
+  uint32_t address_cells;
+  uint64_t offset;  // from the beginning of the file
+  uint64_t size;
+};
+
+// Call |fn(cell, bytes)| for each cell of the finest level that
+// [addr, addr + size) overlaps, where each cell is |cell_bytes| of the
+// compacted address space of |blocks|.
+template <typename Fn>
+void for_each_heatmap_cell(const std::vector<int64_t> &blocks,
+                           int64_t cell_bytes, int64_t addr, int64_t size,
+                           Fn fn) {
+  const int64_t end = addr + size;
+  while (addr < end) {
+    const int64_t block = addr / kHeatmapBlockSize;
+    const int64_t block_end =
+        std::min(end, (block + 1) * kHeatmapBlockSize);
+    const int64_t base =
+        (std::lower_bound(blocks.begin(), blocks.end(), block) -
+         blocks.begin()) * kHeatmapBlockSize;
+    int64_t offset = base + addr % kHeatmapBlockSize;
+    const int64_t offset_end = base + (block_end - 1) % kHeatmapBlockSize + 1;
+    while (offset < offset_end) {
+      const int64_t cell = offset / cell_bytes;
+      const int64_t next = std::min(offset_end, (cell + 1) * cell_bytes);
+      fn(cell, next - offset);
+      offset = next;
+    }
+    addr = block_end;
+  }
+}
+
+// Write the heatmap of |heatmap_events| to |path| with |resolution| cells per
+// side at the finest level.
+void write_heatmap(const char *path, int resolution) {
+  std::vector<int64_t> blocks;
+  for (const HeatmapEvent &e : heatmap_events) {
+    for (int64_t b = e.addr / kHeatmapBlockSize;
+         b <= (e.addr + std::max<int64_t>(e.size, 1) - 1) / kHeatmapBlockSize;
+         b++) {
+      blocks.push_back(b);
+    }
+  }
+  std::sort(blocks.begin(), blocks.end());
+  blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+  const int64_t n = resolution;
+  const int64_t num_ops = heatmap_events.size();
+  const int64_t address_size = blocks.size() * kHeatmapBlockSize;
+  const int64_t cell_ops = std::max<int64_t>(1, (num_ops + n - 1) / n);
+  const int64_t cell_bytes = std::max<int64_t>(1, (address_size + n - 1) / n);
+
+  // Integrate the mapped and allocated bytes of each cell over its ops. At
+  // the beginning of a time cell every address cell is charged for its
+  // current bytes over the whole time cell, and each op then corrects the
+  // rest of the time cell by the bytes it changes.
+  std::vector<double> current[2] = {std::vector<double>(n, 0),
+                                    std::vector<double>(n, 0)};
+  std::vector<double> integral[2] = {std::vector<double>(n * n, 0),
+                                     std::vector<double>(n * n, 0)};
+  int64_t time_cell = -1;
+  for (int64_t i = 0; i < num_ops; i++) {
+    if (i / cell_ops != time_cell) {
+      time_cell = i / cell_ops;
+      for (int plane = 0; plane < 2; plane++) {
+        for (int64_t a = 0; a < n; a++) {
+          integral[plane][a * n + time_cell] = current[plane][a] * cell_ops;
+        }
+      }
+    }
+    const HeatmapEvent &e = heatmap_events[i];
+    int plane, sign;
+    switch (e.op) {
+      case 'm': case 'c': plane = 0; sign = 1; break;
+      case 'u': case 'd': plane = 0; sign = -1; break;
+      case 'a': case 'A': plane = 1; sign = 1; break;
+      default: plane = 1; sign = -1; break;  // 'f'
+    }
+    const int64_t remaining_ops = (time_cell + 1) * cell_ops - i;
+    for_each_heatmap_cell(
+        blocks, cell_bytes, e.addr, e.size, [&](int64_t a, int64_t bytes) {
+          current[plane][a] += sign * bytes;
+          integral[plane][a * n + time_cell] += sign * bytes * remaining_ops;
+        });
+  }
+  for (int plane = 0; plane < 2; plane++) {
+    for (double &v : integral[plane]) {
+      v = std::min(1.0, std::max(0.0, v / cell_bytes / cell_ops));
+    }
+  }
+
+  // Halve the finest level until it is one tile.
+  std::vector<std::vector<double>> levels[2];
+  for (int plane = 0; plane < 2; plane++) {
+    levels[plane].push_back(integral[plane]);
+    for (int64_t size = n; size > kHeatmapTileSize; size /= 2) {
+      const std::vector<double> &fine = levels[plane].back();
+      std::vector<double> coarse((size / 2) * (size / 2));
+      for (int64_t a = 0; a < size / 2; a++) {
+        for (int64_t t = 0; t < size / 2; t++) {
+          coarse[a * (size / 2) + t] =
+              (fine[2 * a * size + 2 * t] + fine[2 * a * size + 2 * t + 1] +
+               fine[(2 * a + 1) * size + 2 * t] +
+               fine[(2 * a + 1) * size + 2 * t + 1]) / 4;
+        }
+      }
+      levels[plane].push_back(coarse);
+    }
+    std::reverse(levels[plane].begin(), levels[plane].end());
+  }
+
+  HeatmapHeader header = {{'M', 'H', 'E', 'A', 'T', 'M', 'A', 'P'},
+                          1,
+                          (uint32_t)levels[0].size(),
+                          kHeatmapTileSize,
+                          0,
+                          (uint64_t)num_ops,
+                          kHeatmapBlockSize,
+                          blocks.size(),
+                          (uint64_t)cell_ops,
+                          (uint64_t)cell_bytes};
+  std::vector<HeatmapLevel> level_table;
+  uint64_t offset = sizeof(header) + levels[0].size() * sizeof(HeatmapLevel) +
+                    blocks.size() * sizeof(uint64_t);
+  for (size_t z = 0; z < levels[0].size(); z++) {
+    const uint32_t size = kHeatmapTileSize << z;
+    level_table.push_back({size, size, offset, 2ull * size * size});
+    offset += 2ull * size * size;
+  }
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(level_table.data(), sizeof(HeatmapLevel), level_table.size(), fp);
+  for (int64_t b : blocks) {
+    const uint64_t block_addr = b * kHeatmapBlockSize;
+    fwrite(&block_addr, sizeof(block_addr), 1, fp);
+  }
+  std::vector<uint8_t> tile(2 * kHeatmapTileSize * kHeatmapTileSize);
+  for (size_t z = 0; z < levels[0].size(); z++) {
+    const int64_t size = kHeatmapTileSize << z;
+    const int64_t tiles = size / kHeatmapTileSize;
+    for (int64_t ta = 0; ta < tiles; ta++) {
+      for (int64_t tt = 0; tt < tiles; tt++) {
+        for (int plane = 0; plane < 2; plane++) {
+          for (int64_t a = 0; a < kHeatmapTileSize; a++) {
+            for (int64_t t = 0; t < kHeatmapTileSize; t++) {
+              const double v =
+                  levels[plane][z][(ta * kHeatmapTileSize + a) * size +
+                                   tt * kHeatmapTileSize + t];
+              tile[(plane * kHeatmapTileSize + a) * kHeatmapTileSize + t] =
+                  (uint8_t)(v * 255 + 0.5);
+            }
+          }
+        }
+        fwrite(tile.data(), 1, tile.size(), fp);
+      }
+    }
+  }
+  fclose(fp);
+  fprintf(stderr, "heatmap: %s (%zu levels, %zu blocks, %ld ops/cell, "
+          "%ld bytes/cell)\n", path, level_table.size(), blocks.size(),
+          cell_ops, cell_bytes);
+}
+
+void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-d] [-t heatmap.bin] [-r resolution] < trace > "
+          "timeline.dat\n"
+          "  -d  Read the decimal trace format of the malloc challenge, which\n"
+          "      also has the m / u / d / c ops of the mapped memory\n"
+          "  -t  Write heatmap tiles for the visualizer to this file\n"
+          "  -r  Cells per side of the finest heatmap level, a power of two\n"
+          "      multiple of %d (default: 1024)\n",
+          argv0, kHeatmapTileSize);
+}
+
+int main(int argc, char **argv) {
   char op;
   int64_t addr;
   int64_t count = 0;
   int64_t last_resident_size = 0;
+  bool decimal = false;
+  const char *heatmap_path = nullptr;
+  int heatmap_resolution = 1024;
+  int opt;
+  while ((opt = getopt(argc, argv, "dt:r:")) != -1) {
+    if (opt == 'd') {
+      decimal = true;
+    } else if (opt == 't') {
+      heatmap_path = optarg;
+      heatmap_enabled = true;
+    } else if (opt == 'r') {
+      heatmap_resolution = atoi(optarg);
+    } else {
+      print_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (heatmap_resolution < kHeatmapTileSize ||
+      heatmap_resolution % kHeatmapTileSize ||
+      (heatmap_resolution & (heatmap_resolution - 1))) {
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
   trace_fp = fopen("trace.txt", "wb");
   if (!trace_fp) {
     printf("Failed to open trace file");
     exit(EXIT_FAILURE);
   }
-  while (scanf(" %c %lX", &op, (uint64_t *)&addr) == 2) {
-    if (op == 'a') {
+  while ((decimal ? scanf(" %c %ld", &op, &addr)
+                  : scanf(" %c %lX", &op, (uint64_t *)&addr)) == 2) {
+    if (decimal) {
+      int64_t size;
+      if (scanf(" %ld", &size) != 1) {
+        printf("Failed to read size");
+        exit(EXIT_FAILURE);
+      }
+      if (op == 'a' || op == 'A') {
+        record_alloc(addr, size, op);
+      } else if (op == 'f') {
+        record_free(addr);
+      } else if (op == 'm' || op == 'u' || op == 'd' || op == 'c') {
+        trace_op(op, addr, size);
+        continue;
+      } else {
+        printf("Unknown op: %c at count %ld\n", op, count);
+        exit(EXIT_FAILURE);
+      }
+    } else if (op == 'a') {
       int64_t size;
       if (scanf(" %lX", (uint64_t *)&size) != 1) {
         printf("Failed to read size for alloc");
         exit(EXIT_FAILURE);
       }
       record_alloc(addr, size);
-    } else if (op == 'r') {
+    } else if (op == 'r' || op == 'R') {
+      // realloc / reallocarray
       int64_t size, old_addr;
       if (scanf(" %lX %lX", (uint64_t *)&size, (uint64_t *)&old_addr) != 2) {
         printf("Failed to read size and old_addr for realloc");
         exit(EXIT_FAILURE);
       }
+      if (op == 'R') {
+        reallocarray_count++;
+      }
       // free
       if (old_addr) {
         record_free(old_addr);
       }
       record_alloc(addr, size);
+    } else if (op == 'A') {
+      // posix_memalign / aligned_alloc / memalign / valloc / pvalloc
+      int64_t size, alignment;
+      char entry_point[32];
+      if (scanf(" %lX %lX %31s", (uint64_t *)&size, (uint64_t *)&alignment,
+                entry_point) != 3) {
+        printf("Failed to read size, alignment and entry point for aligned "
+               "alloc");
+        exit(EXIT_FAILURE);
+      }
+      aligned_allocs[alignment].first++;
+      aligned_allocs[alignment].second += size;
+      aligned_entry_points[entry_point].first++;
+      aligned_entry_points[entry_point].second += size;
+      record_alloc(addr, size, 'A');
+    } else if (op == 'U') {
+      // malloc_usable_size: does not change the heap.
+      int64_t usable_size;
+      if (scanf(" %lX", (uint64_t *)&usable_size) != 1) {
+        printf("Failed to read size for malloc_usable_size");
+        exit(EXIT_FAILURE);
+      }
+      usable_size_queries++;
+      const auto &it = alloc_sizes.find(addr);
+      if (it != alloc_sizes.end()) {
+        usable_size_slack += usable_size - it->second.size;
+      }
+      continue;
     } else if (op == 'f') {
       record_free(addr);
+    } else if (op == 't') {
+      // A timestamp (MALLOC_TRACE_TIME=1) for the following op.
+      current_time = addr;
+      continue;
+    } else if (op == 's') {
+      // The call site of the following op: |addr| return addresses.
+      current_site_pcs.resize(addr);
+      for (int64_t i = 0; i < addr; i++) {
+        if (scanf(" %lX", &current_site_pcs[i]) != 1) {
+          printf("Failed to read the call site");
+          exit(EXIT_FAILURE);
+        }
+      }
+      continue;
+    } else if (op == 'l') {
+      // An executable mapping, to symbolize the call sites.
+      Mapping m;
+      char path[4096];
+      m.begin = addr;
+      if (scanf(" %lX %lX %4095[^\n]", &m.end, &m.file_offset, path) != 3) {
+        printf("Failed to read the mapping");
+        exit(EXIT_FAILURE);
+      }
+      m.path = path;
+      mappings.push_back(m);
+      continue;
     } else {
       printf("Unknown op: %c at count %ld\n", op, count);
       exit(EXIT_FAILURE);
@@ -89,6 +769,7 @@ int main() {
            free_size_accumlated);
     last_resident_size = resident_size;
     count++;
+    current_op = count;
   }
   fprintf(stderr, "count: %ld\n", count);
   fprintf(stderr, "peak_size: %ld\n", peak_size);
@@ -101,5 +782,12 @@ int main() {
           range_end);
   fprintf(stderr, "range_size: %ld\n",
           range_end - range_begin);
+  print_lifetime_stats();
+  print_entry_point_stats();
+  print_site_stats();
+  if (heatmap_path) {
+    write_heatmap(heatmap_path, heatmap_resolution);
+  }
+  fclose(trace_fp);
   return 0;
 }
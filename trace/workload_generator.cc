@@ -0,0 +1,264 @@
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "buckets.h"
+#include "hook_trace.h"
+
+/*
+Fits a workload model to a malloc trace and generates synthetic traces from
+it, so that an allocator can be run on something that looks like a real
+program for much longer than the program itself ran.
+
+The model has:
+  - the size distribution (every distinct size and its count), and
+  - for each size bucket [2^b, 2^(b+1)), the fraction of the objects which are
+    never freed and the quantiles of the lifetime of the others.
+The lifetime is counted in ops (allocations and frees), so the interleaving
+of allocations and frees follows from it: a synthetic trace frees an object
+once its lifetime has passed, and allocates otherwise.
+
+fit:       workload_generator.bin [-d] < trace > model.txt
+generate:  workload_generator.bin -m model.txt -g N [-s seed] > trace.txt
+The model is also read by malloc/malloc_challenge.bin --workload.
+
+input trace format: hook.c, or the malloc challenge with -d (see
+hook_trace.h)
+model format (text):
+  workload <allocations> <ops>
+  sizes <number of sizes>
+  <size> <count>                 (one line per size)
+  lifetimes <number of buckets> <number of quantiles>
+  <bucket> <count> <immortal fraction> <quantile>...  (one line per bucket)
+output trace format (hook.c, numbers in hex, addresses are synthetic):
+  a <addr> <size>
+  f <addr>
+*/
+
+constexpr int kNumQuantiles = 32;
+
+struct Allocation {
+  int64_t size;
+  int64_t begin_op;
+};
+
+struct Model {
+  int64_t allocations = 0;
+  int64_t ops = 0;
+  std::map<int64_t, int64_t> sizes;  // size -> count
+  struct Bucket {
+    int64_t count = 0;
+    double immortal_fraction = 0;
+    std::vector<double> quantiles;  // of the lifetime in ops
+  };
+  std::map<int, Bucket> buckets;
+};
+
+std::unordered_map<int64_t, Allocation> live_allocations;
+// Size bucket -> lifetimes (in ops) of the freed objects.
+std::vector<int64_t> lifetimes[NUM_BUCKETS];
+int64_t immortal_counts[NUM_BUCKETS];
+Model model;
+
+void record_alloc(int64_t addr, int64_t size) {
+  live_allocations[addr] = {size, model.ops++};
+  model.sizes[size]++;
+  model.allocations++;
+}
+
+void record_free(int64_t addr) {
+  const auto &it = live_allocations.find(addr);
+  if (it != live_allocations.end()) {
+    lifetimes[bucket_of(it->second.size)].push_back(model.ops -
+                                                    it->second.begin_op);
+    live_allocations.erase(it);
+  }
+  model.ops++;
+}
+
+void fit() {
+  for (const auto &it : live_allocations) {
+    immortal_counts[bucket_of(it.second.size)]++;
+  }
+  for (int b = 0; b < NUM_BUCKETS; b++) {
+    std::vector<int64_t> &l = lifetimes[b];
+    const int64_t count = l.size() + immortal_counts[b];
+    if (!count) continue;
+    Model::Bucket &bucket = model.buckets[b];
+    bucket.count = count;
+    bucket.immortal_fraction = (double)immortal_counts[b] / count;
+    std::sort(l.begin(), l.end());
+    for (int q = 0; q < kNumQuantiles && !l.empty(); q++) {
+      bucket.quantiles.push_back(l[q * (l.size() - 1) / (kNumQuantiles - 1)]);
+    }
+  }
+}
+
+void write_model(FILE *fp) {
+  fprintf(fp, "workload %ld %ld\n", model.allocations, model.ops);
+  fprintf(fp, "sizes %zu\n", model.sizes.size());
+  for (const auto &it : model.sizes) {
+    fprintf(fp, "%ld %ld\n", it.first, it.second);
+  }
+  fprintf(fp, "lifetimes %zu %d\n", model.buckets.size(), kNumQuantiles);
+  for (const auto &it : model.buckets) {
+    fprintf(fp, "%d %ld %f", it.first, it.second.count,
+            it.second.immortal_fraction);
+    for (int q = 0; q < kNumQuantiles; q++) {
+      // A bucket of immortal objects only has no quantiles.
+      fprintf(fp, " %.0f",
+              it.second.quantiles.empty() ? 0 : it.second.quantiles[q]);
+    }
+    fprintf(fp, "\n");
+  }
+}
+
+bool read_model(FILE *fp) {
+  size_t num_sizes, num_buckets;
+  int num_quantiles;
+  if (fscanf(fp, " workload %ld %ld sizes %zu", &model.allocations,
+             &model.ops, &num_sizes) != 3) {
+    return false;
+  }
+  for (size_t i = 0; i < num_sizes; i++) {
+    int64_t size, count;
+    if (fscanf(fp, " %ld %ld", &size, &count) != 2) return false;
+    model.sizes[size] = count;
+  }
+  if (fscanf(fp, " lifetimes %zu %d", &num_buckets, &num_quantiles) != 2 ||
+      num_quantiles < 2) {
+    return false;
+  }
+  for (size_t i = 0; i < num_buckets; i++) {
+    int b;
+    Model::Bucket bucket;
+    if (fscanf(fp, " %d %ld %lf", &b, &bucket.count,
+               &bucket.immortal_fraction) != 3) {
+      return false;
+    }
+    bucket.quantiles.resize(num_quantiles);
+    for (int q = 0; q < num_quantiles; q++) {
+      if (fscanf(fp, " %lf", &bucket.quantiles[q]) != 1) return false;
+    }
+    model.buckets[b] = bucket;
+  }
+  return true;
+}
+
+// Write a synthetic trace of |allocations| allocations drawn from |model|.
+void generate(int64_t allocations, unsigned seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<int64_t> sizes;
+  std::vector<double> weights;
+  for (const auto &it : model.sizes) {
+    sizes.push_back(it.first);
+    weights.push_back(it.second);
+  }
+  std::discrete_distribution<size_t> size_distribution(weights.begin(),
+                                                       weights.end());
+  std::uniform_real_distribution<double> uniform(0, 1);
+  // (the op to free at, the address), the earliest first.
+  std::priority_queue<std::pair<int64_t, int64_t>,
+                      std::vector<std::pair<int64_t, int64_t>>,
+                      std::greater<std::pair<int64_t, int64_t>>>
+      frees;
+  int64_t op = 0;
+  int64_t next_addr = 0x10000;
+  for (int64_t i = 0; i < allocations; op++) {
+    if (!frees.empty() && frees.top().first <= op) {
+      printf("f %lx\n", frees.top().second);
+      frees.pop();
+      continue;
+    }
+    const int64_t size = sizes[size_distribution(rng)];
+    const Model::Bucket &bucket = model.buckets[bucket_of(size)];
+    const int64_t addr = next_addr;
+    next_addr += (std::max<int64_t>(size, 1) + 15) / 16 * 16;
+    printf("a %lx %lx\n", addr, size);
+    i++;
+    const double u = uniform(rng);
+    if (u < bucket.immortal_fraction) {
+      continue;
+    }
+    // Interpolate between the quantiles.
+    const double x = (u - bucket.immortal_fraction) /
+                     (1 - bucket.immortal_fraction) *
+                     (bucket.quantiles.size() - 1);
+    const size_t q = std::min<size_t>(x, bucket.quantiles.size() - 2);
+    const double lifetime =
+        bucket.quantiles[q] +
+        (bucket.quantiles[q + 1] - bucket.quantiles[q]) * (x - q);
+    frees.push({op + std::max<int64_t>(1, lifetime + 0.5), addr});
+  }
+}
+
+void print_usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-d] < trace > model.txt\n"
+          "       %s -m model.txt -g allocations [-s seed] > trace.txt\n"
+          "  -d  Read the decimal trace format of the malloc challenge\n"
+          "  -m  Read the model from this file\n"
+          "  -g  Generate a trace with this many allocations from the model\n"
+          "  -s  The random seed of -g (default: 1)\n",
+          argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+  bool decimal = false;
+  const char *model_path = nullptr;
+  int64_t allocations = 0;
+  unsigned seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "dm:g:s:")) != -1) {
+    if (opt == 'd') {
+      decimal = true;
+    } else if (opt == 'm') {
+      model_path = optarg;
+    } else if (opt == 'g') {
+      allocations = atol(optarg);
+    } else if (opt == 's') {
+      seed = strtoul(optarg, nullptr, 10);
+    } else {
+      print_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (model_path) {
+    FILE *fp = fopen(model_path, "r");
+    if (!fp || !read_model(fp)) {
+      fprintf(stderr, "Failed to read the model: %s\n", model_path);
+      exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+    if (allocations <= 0) {
+      print_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+    generate(allocations, seed);
+    return 0;
+  }
+
+  read_trace(decimal, record_alloc, record_free);
+  if (!model.allocations) {
+    fprintf(stderr, "No allocations found in the trace\n");
+    exit(EXIT_FAILURE);
+  }
+  fit();
+  int64_t immortal = 0;
+  for (int b = 0; b < NUM_BUCKETS; b++) immortal += immortal_counts[b];
+  fprintf(stderr, "allocations: %ld\n", model.allocations);
+  fprintf(stderr, "ops: %ld (%.1f%% allocations)\n", model.ops,
+          100.0 * model.allocations / model.ops);
+  fprintf(stderr, "distinct sizes: %zu\n", model.sizes.size());
+  fprintf(stderr, "never freed: %ld\n", immortal);
+  write_model(stdout);
+  return 0;
+}
@@ -2,16 +2,18 @@ const opsPerSecInput = document.getElementById('opsPerSec');
 const utilizationSpan = document.getElementById('utilizationSpan');
 // Pixels value:
 // 0: not allocated nor mapped (light)
-// 1: not allocated nor mapped (dark)
+// 1: mapped but decommitted
 // 2: mapped but not allocated
 // 3: mapped but not allocated
 // 4: mapped and allocated
+// 5: mapped and allocated with an alignment
 const colorMap = [
   [0xc8, 0xc8, 0xcb],  // grey
   [0x84, 0x91, 0x9e],  // dark grey
   [0x4d, 0xc4, 0xff],  // skyblue
   [0xff, 0x4b, 0x00],  // red
   [0x03, 0xaf, 0x7a],
+  [0x99, 0x00, 0x99],  // purple
 ];
 // c.f. https://oku.edu.mie-u.ac.jp/~okumura/stat/colors.html
 
@@ -56,10 +58,10 @@ function drawPixelsFromTrace(begin, end, ops, hsegments, endIndex) {
   for (let i = 0; i < ops.length; i++) {
     if (i >= endIndex) break;
     const e = ops[i];
-    if (e[0] == 'a') {
+    if (e[0] == 'a' || e[0] == 'A') {
       allocated += e[2];
       for (let i = e[1]; i < e[1] + e[2]; i++) {
-        pixels[i - begin] = 4;
+        pixels[i - begin] = e[0] == 'A' ? 5 : 4;
       }
     }
     if (e[0] == 'f') {
@@ -80,6 +82,18 @@ function drawPixelsFromTrace(begin, end, ops, hsegments, endIndex) {
         pixels[i - begin] = 0;
       }
     }
+    if (e[0] == 'd') {
+      mapped -= e[2];
+      for (let i = e[1]; i < e[1] + e[2]; i++) {
+        pixels[i - begin] = 1;
+      }
+    }
+    if (e[0] == 'c') {
+      mapped += e[2];
+      for (let i = e[1]; i < e[1] + e[2]; i++) {
+        pixels[i - begin] = 2;
+      }
+    }
   }
   drawPixels(pixels, hsegments);
   progressSpan.innerText = `${endIndex} / ${ops.length}`;
@@ -120,7 +134,7 @@ function loadData(input) {
   for (const e of ops) {
     range_begin = Math.min(range_begin, e[1]);
     range_end = Math.max(range_end, e[1] + e[2]);
-    if (e[0] == 'a') {
+    if (e[0] == 'a' || e[0] == 'A') {
       allocated_acc += e[2];
       allocated_now += e[2];
     }
@@ -131,9 +145,12 @@ function loadData(input) {
     if (e[0] == 'm') {
       mapped_now += e[2];
     }
-    if (e[0] == 'u') {
+    if (e[0] == 'u' || e[0] == 'd') {
       mapped_now -= e[2];
     }
+    if (e[0] == 'c') {
+      mapped_now += e[2];
+    }
     stat_allocated_labels.push(count);
     stat_allocated_now.push(allocated_now);
     stat_allocated_acc.push(allocated_acc);
@@ -210,6 +227,270 @@ function drawVisualizer() {
       progress.value);
 }
 
+// Heatmap tiles written by `trace2timeline.bin -t` (see trace2timeline.cc
+// for the format). Only the header and the tiles in view are read, so a
+// heatmap of a huge trace can be opened from a file or over HTTP and panned
+// and zoomed interactively.
+const HEATMAP_MAGIC = 'MHEATMAP';
+const HEATMAP_HEADER_SIZE = 64;
+const HEATMAP_LEVEL_SIZE = 24;
+// Tiles read and drawn so far are kept up to this number.
+const HEATMAP_MAX_TILES = 256;
+// The view can be zoomed in until it is this many cells of the finest level.
+const HEATMAP_MIN_VIEW_CELLS = 16;
+// One wheel step zooms by this factor.
+const HEATMAP_ZOOM_STEP = 1.25;
+const heatmapDiv = document.querySelector('#heatmapDiv');
+const heatmapCanvas = document.querySelector('#heatmapCanvas');
+const heatmapLevelSelect = document.querySelector('#heatmapLevel');
+const heatmapInfoSpan = document.querySelector('#heatmapInfoSpan');
+
+// Return a function which reads [begin, end) of |source|, a File or a URL.
+function rangeReader(source) {
+  if (source instanceof Blob) {
+    return (begin, end) => source.slice(begin, end).arrayBuffer();
+  }
+  return async (begin, end) => {
+    const response =
+        await fetch(source, {headers: {Range: `bytes=${begin}-${end - 1}`}});
+    const buffer = await response.arrayBuffer();
+    // The server may ignore the range and send the whole file.
+    return response.status == 206 ? buffer : buffer.slice(begin, end);
+  };
+}
+
+async function loadHeatmap(source) {
+  const read = rangeReader(source);
+  const header = new DataView(await read(0, HEATMAP_HEADER_SIZE));
+  const numLevels = header.getUint32(12, true);
+  const levelTable = new DataView(await read(
+      HEATMAP_HEADER_SIZE,
+      HEATMAP_HEADER_SIZE + numLevels * HEATMAP_LEVEL_SIZE));
+  const levels = [];
+  for (let z = 0; z < numLevels; z++) {
+    const o = z * HEATMAP_LEVEL_SIZE;
+    levels.push({
+      timeCells: levelTable.getUint32(o, true),
+      addressCells: levelTable.getUint32(o + 4, true),
+      offset: Number(levelTable.getBigUint64(o + 8, true)),
+      size: Number(levelTable.getBigUint64(o + 16, true)),
+    });
+  }
+  window.malloc_heatmap = {
+    read,
+    tileSize: header.getUint32(16, true),
+    numOps: Number(header.getBigUint64(24, true)),
+    numBlocks: Number(header.getBigUint64(40, true)),
+    levels,
+    // `${z},${ta},${tt}` -> a promise of the canvas of the tile at (address
+    // tile, time tile) = (ta, tt) of zoom level z, the least recently read
+    // first.
+    tiles: new Map(),
+    // The part of the heatmap in view as fractions of the time (x) and the
+    // address (y) axes.
+    view: {x: 0, y: 0, width: 1, height: 1},
+    // Incremented by every drawHeatmap(), so that a draw waiting for its tiles
+    // does not overwrite a newer one.
+    generation: 0,
+  };
+  heatmapLevelSelect.innerHTML = '<option value="auto">auto</option>' +
+      levels.map((l, z) => `<option value="${z}">${z} (${l.timeCells})</option>`)
+          .join('');
+  heatmapDiv.style.display = '';
+  await drawHeatmap();
+}
+
+// The coarsest zoom level which has at least one cell per device pixel in
+// the view on a canvas of |width| x |height| pixels.
+function chooseHeatmapLevel(h, width, height) {
+  const z = h.levels.findIndex(
+      l => l.timeCells * h.view.width >= width &&
+          l.addressCells * h.view.height >= height);
+  return z < 0 ? h.levels.length - 1 : z;
+}
+
+// Draw the |cells| of a tile (the mapped plane and then the allocated plane)
+// into a canvas of |t| x |t| pixels.
+function drawHeatmapTile(cells, t) {
+  const canvas = document.createElement('canvas');
+  canvas.width = canvas.height = t;
+  const ctx = canvas.getContext('2d');
+  const image = ctx.createImageData(t, t);
+  const mix = (from, to, ratio) => from + (to - from) * ratio;
+  for (let i = 0; i < t * t; i++) {
+    const mapped = cells[i] / 255;
+    const allocated = cells[t * t + i] / 255;
+    // grey (unmapped) -> skyblue (mapped) -> green (allocated)
+    for (let k = 0; k < 3; k++) {
+      image.data[i * 4 + k] = mix(
+          mix(colorMap[0][k], colorMap[2][k], mapped), colorMap[4][k],
+          allocated);
+    }
+    image.data[i * 4 + 3] = 0xff;
+  }
+  ctx.putImageData(image, 0, 0);
+  return canvas;
+}
+
+// Start reading the tiles [tt0, tt1) of the tile row |ta| of zoom level |z|
+// which are not read yet. The tiles of a row are next to each other in the
+// file, so they are read at once.
+function readHeatmapTiles(h, z, ta, tt0, tt1) {
+  const level = h.levels[z];
+  const t = h.tileSize;
+  const tilesPerSide = level.timeCells / t;
+  const tileBytes = 2 * t * t;
+  const key = (tt) => `${z},${ta},${tt}`;
+  while (tt0 < tt1 && h.tiles.has(key(tt0))) tt0++;
+  while (tt0 < tt1 && h.tiles.has(key(tt1 - 1))) tt1--;
+  if (tt0 == tt1) {
+    return;
+  }
+  const begin = level.offset + (ta * tilesPerSide + tt0) * tileBytes;
+  const row = h.read(begin, begin + (tt1 - tt0) * tileBytes)
+                  .then((buffer) => new Uint8Array(buffer));
+  for (let tt = tt0; tt < tt1; tt++) {
+    if (!h.tiles.has(key(tt))) {
+      const offset = (tt - tt0) * tileBytes;
+      h.tiles.set(key(tt), row.then(
+          (cells) => drawHeatmapTile(
+              cells.subarray(offset, offset + tileBytes), t)));
+    }
+  }
+}
+
+async function drawHeatmap() {
+  const h = window.malloc_heatmap;
+  const generation = ++h.generation;
+  const canvas = heatmapCanvas;
+  const width = Math.round(canvas.offsetWidth * window.devicePixelRatio);
+  const height = Math.round(canvas.offsetHeight * window.devicePixelRatio);
+  const z = heatmapLevelSelect.value == 'auto' ?
+      chooseHeatmapLevel(h, width, height) :
+      parseInt(heatmapLevelSelect.value, 10);
+  const level = h.levels[z];
+  const tilesPerSide = level.timeCells / h.tileSize;
+  const v = h.view;
+  const tt0 = Math.max(0, Math.floor(v.x * tilesPerSide));
+  const tt1 = Math.min(tilesPerSide, Math.ceil((v.x + v.width) * tilesPerSide));
+  const ta0 = Math.max(0, Math.floor(v.y * tilesPerSide));
+  const ta1 =
+      Math.min(tilesPerSide, Math.ceil((v.y + v.height) * tilesPerSide));
+  const tiles = [];
+  for (let ta = ta0; ta < ta1; ta++) {
+    readHeatmapTiles(h, z, ta, tt0, tt1);
+    for (let tt = tt0; tt < tt1; tt++) {
+      const key = `${z},${ta},${tt}`;
+      const image = h.tiles.get(key);
+      // Move the tile to the end of the least recently used order.
+      h.tiles.delete(key);
+      h.tiles.set(key, image);
+      tiles.push({ta, tt, image});
+    }
+  }
+  while (h.tiles.size > Math.max(HEATMAP_MAX_TILES, tiles.length)) {
+    h.tiles.delete(h.tiles.keys().next().value);
+  }
+  const images = await Promise.all(tiles.map((tile) => tile.image));
+  if (generation != h.generation) {
+    return;
+  }
+  // The canvas is resized (which clears it) only once the tiles are read, so
+  // the old view stays until the new one can be drawn.
+  canvas.width = width;
+  canvas.height = height;
+  const ctx = canvas.getContext('2d');
+  ctx.imageSmoothingEnabled = false;
+  // Map a fraction of the time or the address axis to a canvas pixel.
+  const toX = (x) => Math.round((x - v.x) / v.width * width);
+  const toY = (y) => Math.round((y - v.y) / v.height * height);
+  tiles.forEach((tile, i) => {
+    const x = toX(tile.tt / tilesPerSide);
+    const y = toY(tile.ta / tilesPerSide);
+    ctx.drawImage(
+        images[i], x, y, toX((tile.tt + 1) / tilesPerSide) - x,
+        toY((tile.ta + 1) / tilesPerSide) - y);
+  });
+  heatmapInfoSpan.innerText = `level ${z}: ${level.timeCells} x ` +
+      `${level.addressCells} cells, ops ${Math.floor(v.x * h.numOps)}-` +
+      `${Math.ceil((v.x + v.width) * h.numOps)} of ${h.numOps}, ` +
+      `${h.numBlocks} blocks of address space, ${tiles.length} tiles in view`;
+}
+
+// Keep the view inside the heatmap and at least HEATMAP_MIN_VIEW_CELLS cells
+// of the finest level on each side.
+function clampHeatmapView(h) {
+  const finest = h.levels[h.levels.length - 1];
+  const v = h.view;
+  v.width = Math.min(
+      1, Math.max(v.width, HEATMAP_MIN_VIEW_CELLS / finest.timeCells));
+  v.height = Math.min(
+      1, Math.max(v.height, HEATMAP_MIN_VIEW_CELLS / finest.addressCells));
+  v.x = Math.min(Math.max(v.x, 0), 1 - v.width);
+  v.y = Math.min(Math.max(v.y, 0), 1 - v.height);
+}
+
+// The wheel zooms around the cursor, dragging pans and a double click shows
+// the whole heatmap again. The zoom level follows the scale unless one is
+// selected.
+heatmapCanvas.addEventListener('wheel', (evt) => {
+  const h = window.malloc_heatmap;
+  if (!h) {
+    return;
+  }
+  evt.preventDefault();
+  const rect = heatmapCanvas.getBoundingClientRect();
+  const px = (evt.clientX - rect.left) / rect.width;
+  const py = (evt.clientY - rect.top) / rect.height;
+  const v = h.view;
+  const x = v.x + px * v.width;
+  const y = v.y + py * v.height;
+  const factor = Math.pow(HEATMAP_ZOOM_STEP, Math.sign(evt.deltaY));
+  v.width *= factor;
+  v.height *= factor;
+  clampHeatmapView(h);
+  // Keep the point under the cursor where it is.
+  v.x = x - px * v.width;
+  v.y = y - py * v.height;
+  clampHeatmapView(h);
+  drawHeatmap();
+}, {passive: false});
+
+let heatmapDrag = null;
+heatmapCanvas.addEventListener('pointerdown', (evt) => {
+  heatmapCanvas.setPointerCapture(evt.pointerId);
+  heatmapDrag = {x: evt.clientX, y: evt.clientY};
+});
+heatmapCanvas.addEventListener('pointermove', (evt) => {
+  const h = window.malloc_heatmap;
+  if (!h || !heatmapDrag) {
+    return;
+  }
+  const rect = heatmapCanvas.getBoundingClientRect();
+  h.view.x -= (evt.clientX - heatmapDrag.x) / rect.width * h.view.width;
+  h.view.y -= (evt.clientY - heatmapDrag.y) / rect.height * h.view.height;
+  heatmapDrag = {x: evt.clientX, y: evt.clientY};
+  clampHeatmapView(h);
+  drawHeatmap();
+});
+heatmapCanvas.addEventListener('pointerup', () => {
+  heatmapDrag = null;
+});
+heatmapCanvas.addEventListener('dblclick', () => {
+  const h = window.malloc_heatmap;
+  if (h) {
+    h.view = {x: 0, y: 0, width: 1, height: 1};
+    drawHeatmap();
+  }
+});
+
+heatmapLevelSelect.addEventListener('change', () => drawHeatmap());
+window.addEventListener('resize', () => {
+  if (window.malloc_heatmap) {
+    drawHeatmap();
+  }
+});
+
 const handleFileSelect =
     async (evt) => {
   evt.stopPropagation();
@@ -217,6 +498,11 @@ const handleFileSelect =
   var files = evt.dataTransfer.files;
   var output = [];
   for (var i = 0, f; f = files[i]; i++) {
+    const magic = await f.slice(0, HEATMAP_MAGIC.length).text();
+    if (magic == HEATMAP_MAGIC) {
+      loadHeatmap(f);
+      continue;
+    }
     var r = new FileReader();
     r.onload = ((file) => {
       return async (e) => {
@@ -249,6 +535,12 @@ const input = `
 
 loadData(input);
 
+// ?heatmap=<url> opens heatmap tiles served over HTTP.
+const heatmapUrl = new URLSearchParams(window.location.search).get('heatmap');
+if (heatmapUrl) {
+  loadHeatmap(heatmapUrl);
+}
+
 
 const dropZone = document.getElementById('fileDropZone');
 dropZone.addEventListener('dragover', handleDragOver, false);